@@ -35,6 +35,7 @@ I2Cwrapper wrapper(i2cAddress);
 AccelStepperI2C stepperX(&wrapper); // Stepper Motor 1
 AccelStepperI2C stepperY(&wrapper); // Stepper Motor 2
 AccelStepperI2C stepperZ(&wrapper); // Stepper Motor 3
+MultiStepperI2C steppersXYZ(&wrapper); // all three motors, for coordinated moves (see loopCoordinated() below)
 
 bool stepperXdir = true; // true=CW, false=CCW
 bool stepperYdir = true;
@@ -93,6 +94,15 @@ void setup()
   
   stepperZ.setMaxSpeed(defMaxSpeed);
   stepperZ.setAcceleration(defAcceleration);
+
+  // Group the steppers for coordinated moves. Not needed for the default loop() below
+  steppersXYZ.addStepper(stepperX);
+  steppersXYZ.addStepper(stepperY);
+  steppersXYZ.addStepper(stepperZ);
+  if (steppersXYZ.myNum < 0) {
+    Serial.println("Error: stepper group could not be allocated");
+    while (true) {}
+  }
 }
 
 /* This is the recommended AccelStepperI2C implementation using the state machine.
@@ -146,3 +156,24 @@ void loopClassic() {
   { stepperX.moveTo(-stepperX.currentPosition()); }
   stepperX.run(); // frequency is critical, but each call will cause I2C traffic...
 }
+
+/* This is the coordinated implementation using a MultiStepperI2C group. The
+ * target computes the speeds for all three steppers so that they arrive at their
+ * new positions at the same time, so each move needs only one transmission.
+ * Polling isRunning() could again be replaced by the interrupt mechanism
+ * (interruptReason_groupTargetReached).
+ */
+void loopCoordinated() {
+  static bool dir = true;
+  if (!steppersXYZ.isRunning()) {
+    long positions[3] = {stepsToGo, stepsToGo / 2, stepsToGo / 4}; // X, Y, Z
+    if (!dir) {
+      for (uint8_t m = 0; m < 3; m++) {
+        positions[m] = -positions[m];
+      }
+    }
+    steppersXYZ.moveTo(positions); // also starts the state machines of all three steppers
+    dir = !dir;
+  }
+  delay(1000); // Just slow down the main loop a bit...
+}
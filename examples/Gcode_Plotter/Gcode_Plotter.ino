@@ -0,0 +1,87 @@
+/*
+   GcodeI2C plotter demo
+   (c) juh 2023
+
+   Streams a few lines of G-code to a target with two steppers, which plans
+   and executes them on its own. The controller only needs to keep the
+   target's block buffer filled.
+
+   Needs AccelStepperI2C.h and GcodeI2C.h modules enabled (in this order) in
+   the target's firmware_modules.h. Endstops for homing are optional, G28 is
+   skipped if none are defined.
+
+*/
+
+#include <Wire.h>
+#include <AccelStepperI2C.h>
+#include <GcodeI2C.h>
+
+
+uint8_t i2cAddress = 0x08;
+
+I2Cwrapper wrapper(i2cAddress); // each target device is represented by a wrapper...
+AccelStepperI2C stepperX(&wrapper); // ...that the steppers...
+AccelStepperI2C stepperY(&wrapper);
+GcodeI2C gcode(&wrapper); // ...and the G-code interpreter use to communicate with the controller
+
+const char* drawing[] = {
+  "G28 ; home all axes with endstops",
+  "G90",
+  "G0 X10 Y10",
+  "G1 X60 F1200 ; square with 50 mm sides",
+  "G1 Y60",
+  "G1 X10",
+  "G1 Y10",
+  "G91 ; relative moves for a diagonal",
+  "G1 X50 Y50 F600",
+  "G90",
+  "G0 X0 Y0"
+};
+
+void setup()
+{
+  Serial.begin(115200);
+  Wire.begin();
+  // Wire.setClock(10000); // uncomment for ESP8266 targets, to be on the safe side
+
+  if (!wrapper.ping()) {
+    Serial.println("Target not found! Check connections and restart.");
+    while (true) {}
+  }
+
+  wrapper.reset(); // reset the target device
+
+  stepperX.attach(AccelStepper::DRIVER, 2, 5); // CNC shield V3 X axis step/dir pins
+  stepperY.attach(AccelStepper::DRIVER, 3, 6); // CNC shield V3 Y axis step/dir pins
+  if ((stepperX.myNum < 0) or (stepperY.myNum < 0)) { // should not happen after a reset
+    Serial.println("Error: stepper could not be allocated");
+    while (true) {}
+  }
+  stepperX.enableOutputs();
+  stepperY.enableOutputs();
+
+  gcode.setAxis(gcodeAxisX, stepperX, 80.0); // steps per mm
+  gcode.setAxis(gcodeAxisY, stepperY, 80.0);
+  gcode.setMotion(3000, 200); // rapid moves with 3000 mm/min, acceleration 200 mm/s²
+  gcode.setHoming(gcodeAxisX, -20, 2, 3); // fast 20 mm/s towards negative end, slow 2 mm/s, back off 3 mm
+  gcode.setHoming(gcodeAxisY, -20, 2, 3);
+
+  for (uint8_t l = 0; l < sizeof(drawing) / sizeof(drawing[0]); l++) {
+    while (gcode.free() == 0) { // wait for a free slot in the target's buffer
+      delay(20);
+    }
+    Serial.println(drawing[l]);
+    if (gcode.sendLine(drawing[l]) < 0) {
+      Serial.println("Line rejected!");
+    }
+  }
+  while (not gcode.idle()) {
+    delay(100);
+  }
+  Serial.println("Done.");
+}
+
+
+void loop()
+{
+}
@@ -42,27 +42,11 @@ const float acceleration = maxRunSpeed / 4;   // 4 seconds from 0 to max speed.
 I2Cwrapper wrapper(addr); // each target device is represented by a wrapper...
 AccelStepperI2C stepper(&wrapper); // ...that the stepper uses to communicate with the controller
 
-volatile bool interruptFlag = false; // volatile for interrupt
 long lowerEndStopPos, upperEndStopPos, middlePos, range;
 long lower, upper;
 
 
 
-/***********************************************************************************
-
-   ISR
-
- ************************************************************************************/
-// this has to come before setup(), else the Arduino environment will be confused by the conditionals and macros
-#if defined(ESP8266) || defined(ESP32)
-void IRAM_ATTR interruptFromTarget()
-#else
-void interruptFromTarget()
-#endif
-{
-  interruptFlag = true; // just set a flag, leave interrupt as quickly as possible
-}
-
 /***********************************************************************************
 
    SETUP
@@ -126,9 +110,8 @@ void setup()
   wrapper.setInterruptPin(interruptPinTarget, /* activeHigh */ true); // activeHigh -> controller will have to look out for a RISING flank
   stepper.enableInterrupts(); // make target send out interrupts for this stepper at the pin set above
 
-  // And now make the controller listen for the interrupt
-  pinMode(interruptPinController, INPUT);
-  attachInterrupt(digitalPinToInterrupt(interruptPinController), interruptFromTarget, RISING);
+  // And now make the wrapper listen for the interrupt on the controller's side
+  wrapper.setControllerInterruptPin(interruptPinController, /* activeHigh */ true);
 
 
   /*
@@ -217,14 +200,7 @@ void findEndstops(float sp)
 */
 uint8_t waitForInterrupt()
 {
-  while (!interruptFlag) {} // wait until interrupt will set the flag ### will probably need a yield() on ESPs
-  interruptFlag = false; // clear flag
-  uint8_t reasonAndUnit = wrapper.clearInterrupt();
-  if ((reasonAndUnit & 0xf) != stepper.myNum) { // stepper is the only unit in use, so there should be no other unit causing an interrupt
-    Serial.println("Error. Interrupt cause from unknown unit.");
-    while (true) {}
-  }
-  return reasonAndUnit >> 4; // dump unit and return reason in LSBs
+  return wrapper.waitFor(anyReason, stepper.myNum); // the wrapper clears and decodes the interrupt for us
 }
 
 
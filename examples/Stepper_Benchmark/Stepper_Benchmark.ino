@@ -0,0 +1,128 @@
+/*
+   AccelStepperI2C step rate benchmark
+   (c) juh 2023
+
+   Measures how many steppers at which speeds a target can handle, with and
+   without concurrent I2C traffic. For each combination of number of steppers,
+   requested speed and background message rate, the steppers are run in
+   runSpeed() mode for a couple of seconds, and the target's benchmark results
+   are printed as one line of a table:
+
+   - achieved: lowest step rate achieved by any of the steppers, in percent of
+     the requested speed
+   - jitter: largest difference between longest and shortest step interval of
+     any stepper in microseconds
+   - cycle: longest time the target's loop() needed for one cycle in microseconds
+   - msgs: number of messages the target received during the test
+
+   Needs AccelStepperI2C.h module enabled in the target's firmware_modules.h
+   and ACCELSTEPPERI2C_BENCHMARK defined in AccelStepperI2C_firmware.h.
+   No motors need to be connected, as the steppers are only simulated with
+   DRIVER type step and dir pins.
+
+*/
+
+#include <Wire.h>
+#include <AccelStepperI2C.h>
+
+
+uint8_t i2cAddress = 0x08;
+
+I2Cwrapper wrapper(i2cAddress); // each target device is represented by a wrapper...
+
+const uint8_t maxBenchSteppers = 8;
+// step and dir pins for DRIVER type steppers, 14-17 are A0-A3 on Unos and Nanos
+const uint8_t stepPins[maxBenchSteppers] = {2, 4, 6, 8, 10, 12, 14, 16};
+const uint8_t dirPins[maxBenchSteppers] =  {3, 5, 7, 9, 11, 13, 15, 17};
+AccelStepperI2C* steppers[maxBenchSteppers];
+
+const float speeds[] = {500, 1000, 2000, 4000}; // requested steps per second
+const uint16_t messageRates[] = {0, 20, 100}; // background messages per second
+const uint32_t testDuration = 3000; // ms per test
+
+
+void setup()
+{
+  Serial.begin(115200);
+  Wire.begin();
+  // Wire.setClock(10000); // uncomment for ESP8266 targets, to be on the safe side
+
+  if (!wrapper.ping()) {
+    Serial.println("Target not found! Check connections and restart.");
+    while (true) {}
+  }
+
+  wrapper.reset(); // reset the target device
+
+  for (uint8_t s = 0; s < maxBenchSteppers; s++) {
+    steppers[s] = new AccelStepperI2C(&wrapper);
+    steppers[s]->attach(AccelStepper::DRIVER, stepPins[s], dirPins[s]);
+    if (steppers[s]->myNum < 0) { // should not happen after a reset
+      Serial.println("Error: stepper could not be allocated");
+      while (true) {}
+    }
+    steppers[s]->setMaxSpeed(speeds[sizeof(speeds) / sizeof(speeds[0]) - 1]);
+  }
+
+  Serial.println("steppers\tspeed\tmsgs/s\tachieved\tjitter\tcycle\tmsgs");
+  for (uint8_t n = 1; n <= maxBenchSteppers; n++) {
+    for (uint8_t sp = 0; sp < sizeof(speeds) / sizeof(speeds[0]); sp++) {
+      for (uint8_t r = 0; r < sizeof(messageRates) / sizeof(messageRates[0]); r++) {
+        runTest(n, speeds[sp], messageRates[r]);
+      }
+    }
+  }
+  Serial.println("Done.");
+}
+
+
+void loop()
+{
+}
+
+
+void runTest(uint8_t n, float speed, uint16_t rate)
+{
+  for (uint8_t s = 0; s < n; s++) {
+    steppers[s]->setSpeed(speed);
+    steppers[s]->runSpeedState();
+  }
+  AccelStepperI2C::startBenchmark(&wrapper);
+
+  uint32_t start = millis();
+  uint32_t nextMessage = start;
+  while (millis() - start < testDuration) {
+    if ((rate > 0) and (millis() >= nextMessage)) {
+      steppers[0]->currentPosition(); // any command will do as background traffic
+      nextMessage += 1000 / rate;
+    }
+  }
+
+  AccelStepperI2C::stopBenchmark(&wrapper);
+  for (uint8_t s = 0; s < n; s++) {
+    steppers[s]->stopState();
+  }
+
+  BenchmarkResult result;
+  if (not AccelStepperI2C::benchmarkResult(&wrapper, result)) {
+    Serial.println("Error: no benchmark results. Was the firmware compiled with ACCELSTEPPERI2C_BENCHMARK?");
+    while (true) {}
+  }
+  float achieved = 1000.0; // lowest step rate in percent of requested
+  uint32_t jitter = 0;
+  for (uint8_t s = 0; s < n; s++) {
+    StepTiming t;
+    if (steppers[s]->stepTiming(t) and (result.elapsed > 0)) {
+      achieved = min(achieved, (float)(t.steps * 1e8 / result.elapsed / speed));
+      jitter = max(jitter, t.maxInterval - t.minInterval);
+    }
+  }
+
+  Serial.print(n); Serial.print("\t");
+  Serial.print(speed, 0); Serial.print("\t");
+  Serial.print(rate); Serial.print("\t");
+  Serial.print(achieved, 1); Serial.print("%\t\t");
+  Serial.print(jitter); Serial.print("\t");
+  Serial.print(result.maxCycleTime); Serial.print("\t");
+  Serial.println(result.messages);
+}
@@ -0,0 +1,33 @@
+/*
+   Minimal Arduino.h for compiling AccelStepper and AccelStepperFixedPoint on
+   the host, see fixed_point_comparison.cpp. The pins do nothing, micros()
+   returns a simulated clock which the program advances itself.
+*/
+
+#ifndef Arduino_h
+#define Arduino_h
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define HIGH 0x1
+#define LOW  0x0
+#define INPUT 0x0
+#define OUTPUT 0x1
+
+extern unsigned long simulatedMicros;
+
+inline unsigned long micros() { return simulatedMicros; }
+inline void delayMicroseconds(unsigned int) {}
+inline void pinMode(uint8_t, uint8_t) {}
+inline void digitalWrite(uint8_t, uint8_t) {}
+
+template <typename T> T min(T a, T b) { return a < b ? a : b; }
+template <typename T> T max(T a, T b) { return a > b ? a : b; }
+template <typename T> T constrain(T x, T low, T high) { return x < low ? low : (x > high ? high : x); }
+
+#endif
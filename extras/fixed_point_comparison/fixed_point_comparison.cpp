@@ -0,0 +1,92 @@
+/*
+   Host-side comparison of AccelStepperFixedPoint (firmware/AccelStepperFixedPoint.h)
+   with the original AccelStepper library. Both run the same moves on a
+   simulated clock; the program reports each move's duration and final
+   position, and the largest relative deviation of a step's time.
+
+   Build and run with the Makefile in this folder, which needs the path to the
+   AccelStepper library's source:
+
+     make ACCELSTEPPER=~/Arduino/libraries/AccelStepper/src
+
+   Copyright (c) 2023 juh
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation, version 2.
+*/
+
+#include <stdio.h>
+#include <vector>
+#include <AccelStepper.h>
+#include <AccelStepperFixedPoint.h>
+
+unsigned long simulatedMicros = 0;
+
+struct Move
+{
+  long target;        // steps
+  float maxSpeed;     // steps/s
+  float acceleration; // steps/s²
+  long stopAt;        // call stop() when this position is passed, 0 = never
+};
+
+const Move moves[] = {
+  {2000, 1000, 500, 0},
+  {-5000, 4000, 2000, 0},
+  {20000, 8000, 4000, 0},
+  {3000, 1500, 300, 800},  // stopped while cruising
+  {200, 3000, 200, 0},     // short move, never reaches max. speed
+  {50, 100, 10, 0}         // very short and slow
+};
+
+const unsigned long maxSimulatedTime = 600000000; // µs, in case a stepper never stops
+
+/*
+   Run one move with 1 µs resolution and record the time of each step.
+   Templated, as AccelStepperFixedPoint shadows AccelStepper's functions.
+*/
+template <typename S> std::vector<unsigned long> runMove(S& stepper, const Move& m)
+{
+  std::vector<unsigned long> stepTimes;
+  simulatedMicros = 0;
+  stepper.setMaxSpeed(m.maxSpeed);
+  stepper.setAcceleration(m.acceleration);
+  stepper.moveTo(m.target);
+  long lastPosition = stepper.currentPosition();
+  bool stopped = false;
+  while (stepper.run() and (simulatedMicros < maxSimulatedTime)) {
+    long p = stepper.currentPosition();
+    if (p != lastPosition) {
+      stepTimes.push_back(simulatedMicros);
+      lastPosition = p;
+    }
+    if ((m.stopAt != 0) and not stopped and (labs(p) >= labs(m.stopAt))) {
+      stepper.stop();
+      stopped = true;
+    }
+    simulatedMicros++;
+  }
+  return stepTimes;
+}
+
+int main()
+{
+  printf("  target  maxSpeed  accel  stopAt | position (float/fixed) |  duration µs (float/fixed) | max. step time dev.\n");
+  for (const Move& m : moves) {
+    AccelStepper floatStepper(AccelStepper::DRIVER, 2, 3);
+    AccelStepperFixedPoint fixedStepper(AccelStepper::DRIVER, 2, 3);
+    std::vector<unsigned long> floatTimes = runMove(floatStepper, m);
+    std::vector<unsigned long> fixedTimes = runMove(fixedStepper, m);
+    double maxDeviation = 0.0;
+    for (size_t i = 0; (i < floatTimes.size()) and (i < fixedTimes.size()); i++) {
+      double d = fabs((double)fixedTimes[i] - (double)floatTimes[i]) / (floatTimes[i] > 0 ? floatTimes[i] : 1);
+      maxDeviation = max(maxDeviation, d);
+    }
+    printf("%8ld %9.0f %6.0f %7ld | %10ld / %-10ld | %12lu / %-12lu | %6.2f%%\n",
+           m.target, m.maxSpeed, m.acceleration, m.stopAt,
+           floatStepper.currentPosition(), fixedStepper.currentPosition(),
+           floatTimes.empty() ? 0 : floatTimes.back(), fixedTimes.empty() ? 0 : fixedTimes.back(),
+           maxDeviation * 100.0);
+  }
+  return 0;
+}
@@ -0,0 +1,257 @@
+/*!
+    @file AccelStepperFixedPoint.h
+    @brief Optional replacement for AccelStepper's acceleration profile,
+    used by the AccelStepperI2C firmware module if ACCELSTEPPERI2C_FIXED_POINT
+    is defined.
+
+    AccelStepper computes a new speed after each step with several float
+    divisions and multiplications. On AVRs like the ATmega328 these are
+    emulated in software and limit the number of steppers that can be run at
+    higher speeds. AccelStepperFixedPoint implements the same algorithm (David
+    Austin's, see AccelStepper documentation) with the step interval kept as
+    24.8 fixed point number, so that each step needs only one integer division.
+    Floats are only used by the setters and getters, i.e. when commands from
+    the controller are processed.
+
+    The class derives from AccelStepper, so that pin handling, outputs, pulse
+    width etc. are left to the original. The motion related functions are
+    shadowed (not overridden, as they are not virtual), so they need to be
+    called with a pointer of type AccelStepperFixedPoint*.
+
+    ## Author
+    Copyright (c) 2023 juh
+    ## License
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation, version 2.
+*/
+
+#ifndef AccelStepperFixedPoint_h
+#define AccelStepperFixedPoint_h
+
+#include <AccelStepper.h>
+
+class AccelStepperFixedPoint : public AccelStepper
+{
+public:
+
+  AccelStepperFixedPoint(uint8_t interface = AccelStepper::FULL4WIRE,
+                         uint8_t pin1 = 2, uint8_t pin2 = 3, uint8_t pin3 = 4, uint8_t pin4 = 5,
+                         bool enable = true)
+    : AccelStepper(interface, pin1, pin2, pin3, pin4, enable)
+  {
+    setAcceleration(1.0); // AccelStepper's defaults
+    setMaxSpeed(1.0);
+  }
+
+  void moveTo(long absolute)
+  {
+    if (_target != absolute) {
+      _target = absolute;
+      computeNewSpeed();
+    }
+  }
+
+  void move(long relative)
+  {
+    moveTo(_pos + relative);
+  }
+
+  bool run()
+  {
+    if (runSpeed()) {
+      computeNewSpeed();
+    }
+    return (_stepInterval != 0) or (_target != _pos);
+  }
+
+  bool runSpeed()
+  {
+    if (_stepInterval == 0) {
+      return false;
+    }
+    unsigned long time = micros();
+    if (time - _lastStepTime >= _stepInterval) {
+      _pos += _direction == DIRECTION_CW ? 1 : -1;
+      step(_pos);
+      _lastStepTime = time;
+      return true;
+    }
+    return false;
+  }
+
+  bool runSpeedToPosition()
+  {
+    if (_target == _pos) {
+      return false;
+    }
+    _direction = _target > _pos ? DIRECTION_CW : DIRECTION_CCW;
+    return runSpeed();
+  }
+
+  void setMaxSpeed(float speed)
+  {
+    speed = fabs(speed);
+    if ((speed != 0.0) and (speed != _maxSpeed)) {
+      _maxSpeed = speed;
+      _cmin = (uint32_t)(256000000.0 / speed);
+      long nMaxOld = _nMax;
+      _nMax = (long)((speed * speed) / (2.0 * _acceleration));
+      if (_n > 0) { // accelerating or cruising: n corresponds to the current speed
+        _n = min(_n, nMaxOld);
+        computeNewSpeed();
+      }
+    }
+  }
+
+  float maxSpeed()
+  {
+    return _maxSpeed;
+  }
+
+  void setAcceleration(float acceleration)
+  {
+    acceleration = fabs(acceleration);
+    if ((acceleration != 0.0) and (acceleration != _acceleration)) {
+      if (_acceleration != 0.0) {
+        _n = _n * (_acceleration / acceleration); // Equation 17
+      }
+      float c0 = 0.676 * sqrt(2.0 / acceleration) * 256000000.0; // Equation 15
+      _c0 = c0 < float(maxInterval) ? (uint32_t)c0 : maxInterval;
+      _acceleration = acceleration;
+      _nMax = (long)((_maxSpeed * _maxSpeed) / (2.0 * acceleration));
+      computeNewSpeed();
+    }
+  }
+
+  void setSpeed(float speed)
+  {
+    if (speed == 0.0) {
+      _stepInterval = 0;
+    } else {
+      _stepInterval = fabs(1000000.0 / speed);
+      _direction = (speed > 0.0) ? DIRECTION_CW : DIRECTION_CCW;
+    }
+  }
+
+  float speed()
+  {
+    if (_stepInterval == 0) {
+      return 0.0;
+    }
+    float s = 1000000.0 / _stepInterval;
+    return _direction == DIRECTION_CW ? s : -s;
+  }
+
+  long distanceToGo()
+  {
+    return _target - _pos;
+  }
+
+  long targetPosition()
+  {
+    return _target;
+  }
+
+  long currentPosition()
+  {
+    return _pos;
+  }
+
+  void setCurrentPosition(long position)
+  {
+    _target = _pos = position;
+    _n = 0;
+    _stepInterval = 0;
+  }
+
+  void stop()
+  {
+    if (_stepInterval != 0) {
+      long toStop = stepsToStop() + 1;
+      move(_direction == DIRECTION_CW ? toStop : -toStop);
+    }
+  }
+
+  bool isRunning()
+  {
+    return not ((_stepInterval == 0) and (_target == _pos));
+  }
+
+protected:
+
+  /*
+     Steps needed to come to a halt at the current speed. With constant
+     acceleration, this is the number of steps taken since the start of the
+     ramp (n > 0) or the number of steps left in the deceleration ramp (n < 0),
+     both limited by the ramp's length at max. speed.
+  */
+  long stepsToStop()
+  {
+    if (_stepInterval == 0) {
+      return 0;
+    }
+    return min(_n >= 0 ? _n : -_n, _nMax);
+  }
+
+  /*
+     Integer version of AccelStepper::computeNewSpeed()
+  */
+  void computeNewSpeed()
+  {
+    long distanceTo = distanceToGo();
+    long toStop = stepsToStop();
+    if ((distanceTo == 0) and (toStop <= 1)) { // at the target and it's time to stop
+      _stepInterval = 0;
+      _n = 0;
+      return;
+    }
+    if (distanceTo > 0) { // need to go clockwise from here, maybe decelerate now
+      if (_n > 0) { // accelerating, need to decelerate now? Or going the wrong way?
+        if ((toStop >= distanceTo) or (_direction == DIRECTION_CCW)) {
+          _n = -toStop;
+        }
+      } else if (_n < 0) { // decelerating, need to accelerate again?
+        if ((toStop < distanceTo) and (_direction == DIRECTION_CW)) {
+          _n = -_n;
+        }
+      }
+    } else if (distanceTo < 0) { // need to go anticlockwise from here, maybe decelerate now
+      if (_n > 0) {
+        if ((toStop >= -distanceTo) or (_direction == DIRECTION_CW)) {
+          _n = -toStop;
+        }
+      } else if (_n < 0) {
+        if ((toStop < -distanceTo) and (_direction == DIRECTION_CCW)) {
+          _n = -_n;
+        }
+      }
+    }
+    if (_n == 0) { // first step from stopped
+      _cn = _c0;
+      _direction = (distanceTo > 0) ? DIRECTION_CW : DIRECTION_CCW;
+    } else { // subsequent step, works for accel (n > 0) and decel (n < 0)
+      long d = 4 * _n + 1;
+      _cn = _cn - ((long)(2 * _cn) + (d > 0 ? d : -d) / 2) / d; // Equation 13, rounded
+      _cn = max(_cn, _cmin);
+    }
+    _n++;
+    _stepInterval = _cn >> 8;
+  }
+
+private:
+  static const uint32_t maxInterval = 0x3FFFFFFF; // 2 * _cn must not overflow a long
+  long _pos = 0;
+  long _target = 0;
+  unsigned long _stepInterval = 0; // microseconds, 0 = stopped
+  unsigned long _lastStepTime = 0;
+  long _n = 0;                     // step counter of the current ramp, negative while decelerating
+  long _nMax = 0;                  // length of the acceleration ramp up to max. speed
+  uint32_t _c0 = 0;                // initial step interval (24.8 fixed point)
+  uint32_t _cn = 0;                // current step interval (24.8 fixed point)
+  uint32_t _cmin = 0;              // step interval at max. speed (24.8 fixed point)
+  float _maxSpeed = 0.0;
+  float _acceleration = 0.0;
+};
+
+#endif
@@ -2,8 +2,11 @@
     @file AccelStepperI2C_firmware.h
     @brief Firmware module for the I2Cwrapper firmware.
 
-    Provides control of up to eight stepper motors with up to two endstops each
-    connected to the I2C target.
+    Provides control of stepper motors with up to two endstops each connected
+    to the I2C target: up to 2 steppers on ATtinys, 8 on other AVRs, 16 on
+    ESP32s, and 12 on other platforms (see maxSteppers). Steppers can be grouped for coordinated
+    moves (MultiStepperI2C), and each stepper can work through a queue of
+    motion segments on its own.
 
     ## Author
     Copyright (c) 2022 juh
@@ -28,7 +31,16 @@
 /*##########################################################################################*/
 
 #if MF_STAGE == MF_STAGE_includes
+// #define ACCELSTEPPERI2C_FIXED_POINT // uncomment to use integer math for acceleration profiles, faster on AVRs (see AccelStepperFixedPoint.h)
+// #define ACCELSTEPPERI2C_BENCHMARK // uncomment to enable step rate and jitter measurements (adds some overhead to the state machine)
+// #define ACCELSTEPPERI2C_DUAL_CORE // ESP32 only: uncomment to run the state machine in its own task on the other core
 #include <AccelStepperI2C.h>
+#if defined(ACCELSTEPPERI2C_FIXED_POINT)
+#include "AccelStepperFixedPoint.h"
+#endif
+#if defined(ACCELSTEPPERI2C_DUAL_CORE) && (!defined(ARDUINO_ARCH_ESP32) || defined(CONFIG_FREERTOS_UNICORE))
+#error ACCELSTEPPERI2C_DUAL_CORE needs a dual core ESP32 target.
+#endif
 #endif // MF_STAGE_includes
 
 
@@ -49,7 +61,7 @@ struct Endstop
   bool activeLow;
   //bool internalPullup; // we don't need to store this, we can directly use it when adding the pin
 };
-const uint8_t maxEndstops = 2; // not sure if there are scenarios where more than two make sense, but why not be prepared and make this configurable?
+const uint8_t maxEndstops = 2; // per stepper, allocated only for steppers that use endstops
 const uint32_t endstopDebouncePeriod = 5; // millisecends to keep between triggering endstop interrupts; I measured a couple of switches, none bounced longer than 1 ms so this should be more than safe
 
 
@@ -57,30 +69,190 @@ const uint32_t endstopDebouncePeriod = 5; // millisecends to keep between trigge
    Stepper stuff
 */
 
+// The stepper table is static, so size it to what the platform can handle
+#if defined(ARDUINO_AVR_ATTINYX5) || defined(ARDUINO_AVR_ATTINYX4)
+const uint8_t maxSteppers = 2; // limited memory and pins
+#elif defined(ARDUINO_ARCH_AVR)
 const uint8_t maxSteppers = 8;
+#elif defined(ARDUINO_ARCH_ESP32)
+const uint8_t maxSteppers = 16;
+#else
+const uint8_t maxSteppers = 12;
+#endif
 uint8_t numSteppers = 0; // number of initialised steppers
 
+#if defined(ACCELSTEPPERI2C_FIXED_POINT)
+typedef AccelStepperFixedPoint AccelStepperType; // drop-in replacement, motion functions are shadowed, so always use this type
+#else
+typedef AccelStepper AccelStepperType;
+#endif
+
+/*
+   Motion segment queue stuff
+*/
+
+#if defined(ARDUINO_ARCH_AVR)
+const uint8_t maxQueueSegments = 4; // per stepper, only allocated for steppers that use the queue
+#else
+const uint8_t maxQueueSegments = 16;
+#endif
+
+struct Segment
+{
+  long target;
+  float maxSpeed;
+  float acceleration;
+};
+
+/*
+   Homing sequence, allocated with the first homing command
+*/
+
+const uint8_t homingFastApproach = 0; // run towards the endstop until it is hit
+const uint8_t homingBackOff      = 1; // run away from it until released and at least backOff steps away
+const uint8_t homingSlowApproach = 2; // run towards the endstop again, slowly
+
+struct Homing
+{
+  uint8_t phase;
+  float fastSpeed; // sign gives the direction towards the endstop
+  float slowSpeed;
+  long backOff;
+  long backOffStart; // position where the back off started
+  long position; // position to set when the endstop is reached
+};
+
+/*
+   Position triggers, allocated with the first trigger added to a stepper
+*/
+
+#if defined(ARDUINO_ARCH_AVR)
+const uint8_t maxPositionTriggers = 4; // per stepper
+#else
+const uint8_t maxPositionTriggers = 8; // per stepper, must fit in firedTriggers' bits
+#endif
+
+struct PositionTrigger
+{
+  long position;
+  int8_t pin; // -1 for none
+  uint8_t pinAction; // one of triggerPinToggle, triggerPinHigh, triggerPinLow
+  bool interrupt; // send interruptReason_positionTrigger
+  bool level; // current output level, needed for toggling
+};
+
+/*
+   Jerk limited (S-curve) profile, allocated with the first setJerk command
+*/
+
+#if defined(ARDUINO_ARCH_AVR)
+const uint32_t sCurveUpdateInterval = 2000; // microseconds between speed updates, float math is slow on AVRs
+#else
+const uint32_t sCurveUpdateInterval = 1000;
+#endif
+
+struct SCurve
+{
+  float jerk; // 0 = disabled, use AccelStepper's trapezoidal profile
+  float speed; // current speed, signed, not limited by min. speed
+  float acceleration; // current acceleration, relative to the direction of travel
+  uint32_t lastUpdate;
+};
+
+/*
+   Jog mode, allocated with the first jog command
+*/
+
+const uint32_t jogUpdateInterval = sCurveUpdateInterval; // microseconds between speed updates
+const uint16_t defaultJogTimeout = 500; // ms
+
+struct Jog
+{
+  float targetSpeed; // as last sent by the controller
+  float speed; // current speed, ramped towards targetSpeed
+  uint32_t lastUpdate; // micros() of the last speed update
+  uint32_t lastCommand; // millis() of the last jog command, for the watchdog
+  uint16_t timeout; // ms without jog command until the stepper is stopped, 0 = never
+};
+
 /*
   This struct comprises all stepper parameters needed for local target management
 */
 struct Stepper
 {
-  AccelStepper* stepper;
+  AccelStepperType* stepper;
   uint8_t state = state_stopped;
-  Endstop endstops[maxEndstops];
+  Endstop* endstops = nullptr; // allocated with the first endstop
   uint8_t numEndstops = 0;
   bool interruptsEnabled = false;
   bool endstopsEnabled = false;
   uint8_t prevEndstopState; // needed for detecting rising and falling flanks
   uint32_t endstopDebounceEnd = 0; // used for debouncing, endstops are ignored after a new flank until this time is reached
+  int8_t activeGroup = -1; // group whose coordinated move this stepper is currently part of, -1 for none
+  Segment* queue = nullptr; // ring buffer, allocated when the first segment is queued
+  uint8_t queueHead = 0; // next segment to start
+  uint8_t queueCount = 0; // segments waiting in the queue
+  uint8_t queueLowWater = 0; // 0 = no low water interrupt
+  bool queueLowSignaled = false; // prevents repeated low water interrupts until the queue is refilled
+  float acceleration = 1.0; // mirrors the AccelStepper's current acceleration, needed for chaining segments
+  Homing* homing = nullptr; // allocated with the first homing command
+  PositionTrigger* triggers = nullptr; // allocated with the first position trigger
+  uint8_t numTriggers = 0;
+  uint8_t firedTriggers = 0; // one bit for each trigger that fired since the controller last asked
+  SCurve* sCurve = nullptr; // allocated with the first setJerk command
+  Jog* jog = nullptr; // allocated with the first jog command
 };
 Stepper steppers[maxSteppers];
 
+
+/*
+   Status snapshot, allocated on first use
+*/
+
+StepperStatus* statusSnapshot = nullptr;
+uint8_t numStatusRecords = 0;
+
+
+/*
+   Motion recorder, ring buffer allocated on first use
+*/
+
+#if defined(ARDUINO_ARCH_AVR)
+const uint16_t maxMotionSamples = 24;
+#else
+const uint16_t maxMotionSamples = 512;
+#endif
+
+MotionSample* motionSamples = nullptr;
+uint16_t motionSamplesHead = 0; // oldest sample
+uint16_t numMotionSamples = 0;
+bool recording = false;
+uint16_t recordingMask;
+uint32_t recordingInterval; // microseconds
+uint32_t recordingStart;
+uint32_t lastRecording;
+
+
+/*
+   Stepper groups (MultiStepperI2C)
+*/
+
+const uint8_t maxStepperGroups = 4;
+uint8_t numStepperGroups = 0; // number of initialised groups
+
+struct StepperGroup
+{
+  uint8_t members[maxGroupSize]; // stepper numbers, in the order they were added
+  uint8_t numMembers = 0;
+  bool moving = false; // true while a coordinated move is in progress
+};
+StepperGroup stepperGroups[maxStepperGroups];
+
 /*
   Assign and initialize new stepper. Calls the
     <a href="https://www.airspayce.com/mikem/arduino/AccelStepper/classAccelStepper.html#a3bc75bd6571b98a6177838ca81ac39ab">
     AccelStepper's[1/2] constructor</a>.
-  Returns internal number (0-7) of stepper assigned to new stepper, -1 for error
+  Returns internal number (0 to maxSteppers-1) of stepper assigned to new stepper, -1 for error
 */
 int8_t addStepper(uint8_t interface = AccelStepper::FULL4WIRE,
                   uint8_t pin1 = 2,
@@ -90,8 +262,21 @@ int8_t addStepper(uint8_t interface = AccelStepper::FULL4WIRE,
                   bool enable = true)
 {
   if (numSteppers < maxSteppers) {
-    steppers[numSteppers].stepper = new AccelStepper(interface, pin1, pin2, pin3, pin4, enable);
+    steppers[numSteppers].stepper = new AccelStepperType(interface, pin1, pin2, pin3, pin4, enable);
     steppers[numSteppers].state = state_stopped;
+    steppers[numSteppers].activeGroup = -1;
+    steppers[numSteppers].queue = nullptr;
+    steppers[numSteppers].queueCount = 0;
+    steppers[numSteppers].queueLowWater = 0;
+    steppers[numSteppers].acceleration = 1.0; // AccelStepper's default
+    steppers[numSteppers].homing = nullptr;
+    steppers[numSteppers].triggers = nullptr;
+    steppers[numSteppers].numTriggers = 0;
+    steppers[numSteppers].firedTriggers = 0;
+    steppers[numSteppers].sCurve = nullptr;
+    steppers[numSteppers].jog = nullptr;
+    steppers[numSteppers].endstops = nullptr;
+    steppers[numSteppers].numEndstops = 0;
     log("Add stepper with internal myNum = "); log(numSteppers); log("\n");
     return numSteppers++;
   } else {
@@ -132,103 +317,931 @@ bool validStepper(int8_t s)
   return (s >= 0) and (s < numSteppers);
 }
 
-#endif // MF_STAGE_declarations
+/*
+   Set acceleration and keep track of it, as we need it for chaining segments.
+*/
+void setStepperAcceleration(uint8_t s, float acceleration)
+{
+  steppers[s].stepper->setAcceleration(acceleration);
+  if (acceleration != 0.0) { // AccelStepper ignores 0
+    steppers[s].acceleration = fabs(acceleration);
+  }
+}
+
+/*
+   Append a segment to stepper s's queue. Returns number of free slots left,
+   -1 if the queue is full.
+*/
+int8_t queueSegment(uint8_t s, long target, float maxSpeed, float acceleration)
+{
+  if (steppers[s].queue == nullptr) {
+    steppers[s].queue = new Segment[maxQueueSegments];
+    steppers[s].queueHead = 0;
+    steppers[s].queueCount = 0;
+  }
+  if (steppers[s].queueCount >= maxQueueSegments) {
+    return -1;
+  }
+  Segment* seg = &steppers[s].queue[(steppers[s].queueHead + steppers[s].queueCount) % maxQueueSegments];
+  seg->target = target;
+  seg->maxSpeed = maxSpeed;
+  seg->acceleration = acceleration;
+  steppers[s].queueCount++;
+  if (steppers[s].queueCount > steppers[s].queueLowWater) {
+    steppers[s].queueLowSignaled = false; // refilled, so arm low water interrupt again
+  }
+  return maxQueueSegments - steppers[s].queueCount;
+}
 
+/*
+   Check if stepper s is ready for the next segment: Either it has arrived, or
+   the next segment continues in the same direction and the stepper would now
+   start to decelerate for the current one (AccelStepper will then simply keep
+   its speed, as the new target is further away).
+*/
+bool segmentCanBeChained(uint8_t s)
+{
+  AccelStepperType* st = steppers[s].stepper;
+  long d = st->distanceToGo();
+  if (d == 0) {
+    return true;
+  }
+  long next = steppers[s].queue[steppers[s].queueHead].target - st->targetPosition();
+  if ((d > 0) != (next > 0) or (next == 0)) { // reversal, the stepper needs to stop first
+    return false;
+  }
+  float v = st->speed();
+  return abs(d) <= (long)((v * v) / (2.0 * steppers[s].acceleration)) + 1; // steps needed to stop, like AccelStepper computes them
+}
 
+/*
+   Start the next queued segment for stepper s and check the queue's low water mark.
+*/
+void startNextSegment(uint8_t s)
+{
+  Segment* seg = &steppers[s].queue[steppers[s].queueHead];
+  steppers[s].stepper->setMaxSpeed(seg->maxSpeed);
+  setStepperAcceleration(s, seg->acceleration);
+  steppers[s].stepper->moveTo(seg->target);
+  steppers[s].queueHead = (steppers[s].queueHead + 1) % maxQueueSegments;
+  steppers[s].queueCount--;
+  if ((steppers[s].queueLowWater > 0) and (steppers[s].queueCount <= steppers[s].queueLowWater) and not steppers[s].queueLowSignaled) {
+    steppers[s].queueLowSignaled = true;
+    triggerStepperInterrupt(s, interruptReason_queueLow);
+  }
+}
 
-/*##########################################################################################*/
-/*# MF_STAGE_setup #########################################################################*/
-/*##########################################################################################*/
+bool inStepperMask(uint8_t s, uint16_t mask)
+{
+  return (s < 16) and (mask & (1u << s));
+}
 
+/*
+   Take a snapshot of all steppers selected by mask, so that all values
+   returned by subsequent statusSnapshotCmds stem from the same moment.
+*/
+void takeStatusSnapshot(uint16_t mask)
+{
+  if (statusSnapshot == nullptr) {
+    statusSnapshot = new StepperStatus[maxSteppers];
+  }
+  numStatusRecords = 0;
+  for (uint8_t s = 0; s < numSteppers; s++) {
+    if (inStepperMask(s, mask)) {
+      StepperStatus* st = &statusSnapshot[numStatusRecords++];
+      st->stepper = s;
+      st->state = steppers[s].state;
+      st->endstops = pollEndstops(s);
+      st->currentPosition = steppers[s].stepper->currentPosition();
+      st->distanceToGo = steppers[s].stepper->distanceToGo();
+      st->speed = steppers[s].stepper->speed();
+    }
+  }
+}
 
+/*
+   Write snapshot record r to the output buffer, explicitly typed so that
+   controller and target agree on the format regardless of their platforms.
+   Records beyond the end of the snapshot are sent as zeros, to keep the reply's length fixed.
+*/
+void writeStatusRecord(uint8_t r)
+{
+  StepperStatus st = {0, 0, 0, 0, 0, 0.0};
+  if (r < numStatusRecords) {
+    st = statusSnapshot[r];
+  }
+  bufferOut->write(st.stepper);
+  bufferOut->write(st.state);
+  bufferOut->write(st.endstops);
+  bufferOut->write((int32_t)st.currentPosition);
+  bufferOut->write((int32_t)st.distanceToGo);
+  bufferOut->write(st.speed);
+}
 
-#if MF_STAGE == MF_STAGE_setup
-log("AccelStepperI2C module enabled.\n");
-#endif // MF_STAGE_setup
+/*
+   Motion recorder: sample position and speed of the steppers selected by
+   recordingMask every recordingInterval. When the buffer is full, the oldest
+   samples are overwritten.
+*/
 
+void startRecording(uint32_t interval, uint16_t mask)
+{
+  if (motionSamples == nullptr) {
+    motionSamples = new MotionSample[maxMotionSamples];
+  }
+  motionSamplesHead = numMotionSamples = 0;
+  recordingInterval = interval;
+  recordingMask = mask;
+  recordingStart = lastRecording = micros() - interval; // first sample right away
+  recording = true;
+}
 
+void recordMotion()
+{
+  uint32_t now = micros();
+  if (now - lastRecording < recordingInterval) {
+    return;
+  }
+  lastRecording += recordingInterval;
+  if (now - lastRecording >= recordingInterval) { // we're lagging behind, don't try to catch up
+    lastRecording = now;
+  }
+  for (uint8_t s = 0; s < numSteppers; s++) {
+    if (inStepperMask(s, recordingMask)) {
+      MotionSample* m;
+      if (numMotionSamples < maxMotionSamples) {
+        m = &motionSamples[(motionSamplesHead + numMotionSamples++) % maxMotionSamples];
+      } else { // full, overwrite oldest
+        m = &motionSamples[motionSamplesHead];
+        motionSamplesHead = (motionSamplesHead + 1) % maxMotionSamples;
+      }
+      m->time = now - recordingStart - recordingInterval;
+      m->stepper = s;
+      m->position = steppers[s].stepper->currentPosition();
+      m->speed = lround(steppers[s].stepper->speed()); // whole steps/s, so that compact samples lose nothing
+    }
+  }
+}
 
+MotionSample* motionSample(uint16_t r) // 0 = oldest
+{
+  return &motionSamples[(motionSamplesHead + r) % maxMotionSamples];
+}
+
+/*
+   Write as many samples as fit into the reply, starting with sample r,
+   delta-coded where possible (see motionSampleCompact). The rest of the reply
+   is filled with zeros, to keep its length fixed.
+*/
+void writeMotionSamples(uint16_t r)
+{
+  bufferOut->write(numMotionSamples);
+  uint8_t space = motionSamplesResult - sizeof(numMotionSamples);
+  for (; r < numMotionSamples; r++) {
+    MotionSample* m = motionSample(r);
+    MotionSample* previous = nullptr; // previous sample of the same stepper
+    for (uint16_t p = r; (p > 0) and (r - p < motionSampleSearchDepth); p--) {
+      if (motionSample(p - 1)->stepper == m->stepper) {
+        previous = motionSample(p - 1);
+        break;
+      }
+    }
+    uint32_t dt = (r > 0) ? m->time - motionSample(r - 1)->time : 0;
+    long dp = (previous != nullptr) ? m->position - previous->position : 0;
+    if ((previous != nullptr) and (dt <= 0xffff) and (dp >= -32768) and (dp <= 32767)
+        and (m->speed >= -32768.0) and (m->speed <= 32767.0)) {
+      if (space < motionSampleCompactSize) {
+        break;
+      }
+      bufferOut->write((uint8_t)(m->stepper | motionSampleCompact));
+      bufferOut->write((uint16_t)dt);
+      bufferOut->write((int16_t)dp);
+      bufferOut->write((int16_t)m->speed);
+      space -= motionSampleCompactSize;
+    } else {
+      if (space < motionSampleFullSize) {
+        break;
+      }
+      bufferOut->write((uint8_t)(m->stepper | motionSampleFull));
+      bufferOut->write(m->time);
+      bufferOut->write((int32_t)m->position);
+      bufferOut->write(m->speed);
+      space -= motionSampleFullSize;
+    }
+  }
+  for (; space > 0; space--) {
+    bufferOut->write((uint8_t)0);
+  }
+}
+
+/*
+   Homing: fast approach, back off, slow approach, set position.
+*/
+
+void startHomingPhase(uint8_t s, uint8_t phase)
+{
+  Homing* h = steppers[s].homing;
+  h->phase = phase;
+  switch (phase) {
+    case homingFastApproach:
+      steppers[s].stepper->setSpeed(h->fastSpeed);
+      break;
+    case homingBackOff:
+      h->backOffStart = steppers[s].stepper->currentPosition();
+      steppers[s].stepper->setSpeed(-h->fastSpeed);
+      break;
+    case homingSlowApproach:
+      steppers[s].stepper->setSpeed(h->fastSpeed > 0 ? h->slowSpeed : -h->slowSpeed);
+      break;
+  }
+  steppers[s].prevEndstopState = pollEndstops(s); // only a new rising flank will count
+}
+
+void startHoming(uint8_t s, float fastSpeed, float slowSpeed, long backOff, long position)
+{
+  if (steppers[s].homing == nullptr) {
+    steppers[s].homing = new Homing;
+  }
+  Homing* h = steppers[s].homing;
+  h->fastSpeed = fastSpeed;
+  h->slowSpeed = fabs(slowSpeed);
+  h->backOff = labs(backOff);
+  h->position = position;
+  steppers[s].queueCount = 0;
+  steppers[s].state = state_homing;
+  // if we're sitting on the endstop already, back off first
+  startHomingPhase(s, pollEndstops(s) != 0 ? homingBackOff : homingFastApproach);
+}
+
+/*
+   Add position trigger to stepper s. Returns the trigger's index, -1 if
+   the stepper has no free trigger left.
+*/
+int8_t addPositionTrigger(uint8_t s, long position, int8_t pin, uint8_t pinAction, bool interrupt)
+{
+  if (steppers[s].triggers == nullptr) {
+    steppers[s].triggers = new PositionTrigger[maxPositionTriggers];
+    steppers[s].numTriggers = 0;
+  }
+  if (steppers[s].numTriggers >= maxPositionTriggers) {
+    return -1;
+  }
+  PositionTrigger* t = &steppers[s].triggers[steppers[s].numTriggers];
+  t->position = position;
+  t->pin = pin;
+  t->pinAction = pinAction;
+  t->interrupt = interrupt;
+  t->level = LOW;
+  if (pin >= 0) {
+    pinMode(pin, OUTPUT);
+    digitalWrite(pin, LOW);
+  }
+  return steppers[s].numTriggers++;
+}
+
+/*
+   Fire all triggers of stepper s whose position lies between from (excl.)
+   and to (incl.), i.e. was crossed by the last step(s), in either direction.
+*/
+void checkPositionTriggers(uint8_t s, long from, long to)
+{
+  for (uint8_t j = 0; j < steppers[s].numTriggers; j++) {
+    PositionTrigger* t = &steppers[s].triggers[j];
+    if ((from < to) ? ((from < t->position) and (t->position <= to)) : ((to <= t->position) and (t->position < from))) {
+      if (t->pin >= 0) {
+        switch (t->pinAction) {
+          case triggerPinToggle: t->level = not t->level; break;
+          case triggerPinHigh: t->level = HIGH; break;
+          case triggerPinLow: t->level = LOW; break;
+        }
+        digitalWrite(t->pin, t->level);
+      }
+      steppers[s].firedTriggers |= 1 << j;
+      if (t->interrupt) {
+        triggerStepperInterrupt(s, interruptReason_positionTrigger);
+      }
+    }
+  }
+}
+
+/*
+   Jerk limited profile, replaces AccelStepper::run() in state_run if a jerk
+   was set. Speed and acceleration are updated every sCurveUpdateInterval,
+   in between the stepper is run with runSpeed().
+*/
+
+bool sCurveActive(uint8_t s)
+{
+  return (steppers[s].sCurve != nullptr) and (steppers[s].sCurve->jerk > 0.0);
+}
+
+void setJerk(uint8_t s, float jerk)
+{
+  if (steppers[s].sCurve == nullptr) {
+    if (jerk == 0.0) {
+      return; // nothing to disable
+    }
+    steppers[s].sCurve = new SCurve;
+  }
+  steppers[s].sCurve->jerk = fabs(jerk);
+}
+
+/*
+   Needs to be called when state_run is entered, to pick up the stepper's
+   current speed.
+*/
+void startSCurve(uint8_t s)
+{
+  SCurve* c = steppers[s].sCurve;
+  c->speed = steppers[s].stepper->speed();
+  c->acceleration = 0.0;
+  c->lastUpdate = micros() - sCurveUpdateInterval; // update right away
+}
+
+/*
+   Distance needed to come to a halt from speed u and acceleration a
+   (both relative to the direction of travel), with jerk limited to j and
+   acceleration to aMax.
+*/
+float sCurveStopDistance(float u, float a, float aMax, float j)
+{
+  float d = 0.0;
+  if (a > 0.0) { // bring acceleration down to 0 first
+    float t = a / j;
+    d = u * t + a * t * t / 2.0 - j * t * t * t / 6.0;
+    u += a * a / (2.0 * j);
+  }
+  if (u >= aMax * aMax / j) { // deceleration reaches aMax
+    d += u * (u / aMax + aMax / j) / 2.0;
+  } else { // deceleration never reaches aMax
+    d += u * sqrt(u / j);
+  }
+  return d;
+}
+
+/*
+   Returns false when the target is reached, like AccelStepper::run().
+*/
+bool runSCurve(uint8_t s)
+{
+  AccelStepperType* st = steppers[s].stepper;
+  SCurve* c = steppers[s].sCurve;
+  long toGo = st->distanceToGo();
+  if (toGo == 0) {
+    st->setSpeed(0);
+    c->speed = c->acceleration = 0.0;
+    return false;
+  }
+  uint32_t now = micros();
+  if (now - c->lastUpdate >= sCurveUpdateInterval) {
+    float dt = (now - c->lastUpdate) * 1e-6;
+    c->lastUpdate = now;
+    float aMax = steppers[s].acceleration;
+    float vMax = st->maxSpeed();
+    float j = c->jerk;
+    float dir = c->speed != 0.0 ? (c->speed > 0.0 ? 1.0 : -1.0) : (toGo > 0 ? 1.0 : -1.0);
+    float u = fabs(c->speed);
+    float a = c->acceleration;
+    float distance = dir * toGo; // negative if the target is behind us
+    float targetAcceleration;
+    if ((distance <= 0.0) or (sCurveStopDistance(u, a, aMax, j) + u * dt >= distance)) { // decelerate
+      targetAcceleration = (u <= a * a / (2.0 * j)) ? 0.0 : -aMax; // ease out so that we arrive with a = 0
+    } else if (u + a * fabs(a) / (2.0 * j) < vMax) { // accelerate
+      targetAcceleration = aMax;
+    } else { // cruise (or slow down to a lowered max. speed)
+      targetAcceleration = u > vMax ? -aMax : 0.0;
+    }
+    a = a < targetAcceleration ? min(a + j * dt, targetAcceleration) : max(a - j * dt, targetAcceleration);
+    u += a * dt;
+    if ((a >= 0.0) and (u > vMax)) {
+      u = vMax;
+      a = 0.0;
+    }
+    if (u <= 0.0) { // came to a halt, next update will start in the target's direction
+      u = a = 0.0;
+      dir = toGo > 0 ? 1.0 : -1.0;
+    }
+    c->speed = dir * u;
+    c->acceleration = a;
+    float uMin = sqrt(aMax / 2.0) / 0.676; // AccelStepper's speed for the first step, see Equation 15
+    st->setSpeed(dir * max(u, uMin));
+  }
+  st->runSpeed();
+  return true;
+}
+
+/*
+   Jerk limited version of AccelStepper::stop(): set a new target as close as
+   possible.
+*/
+void stopSCurve(uint8_t s)
+{
+  SCurve* c = steppers[s].sCurve;
+  float u = fabs(c->speed);
+  long d = ceil(sCurveStopDistance(u, c->acceleration, steppers[s].acceleration, c->jerk));
+  steppers[s].stepper->moveTo(steppers[s].stepper->currentPosition() + (c->speed >= 0.0 ? d : -d));
+}
+
+/*
+   Jog mode: the controller streams target speeds, the state machine ramps
+   towards them with the stepper's acceleration.
+*/
+
+Jog* getJog(uint8_t s)
+{
+  if (steppers[s].jog == nullptr) {
+    steppers[s].jog = new Jog;
+    steppers[s].jog->timeout = defaultJogTimeout;
+  }
+  return steppers[s].jog;
+}
+
+void jog(uint8_t s, float speed)
+{
+  Jog* j = getJog(s);
+  j->targetSpeed = speed;
+  j->lastCommand = millis();
+  if (steppers[s].state != state_jog) { // start from the stepper's current speed
+    j->speed = steppers[s].state == state_stopped ? 0.0 : steppers[s].stepper->speed();
+    j->lastUpdate = micros() - jogUpdateInterval; // update right away
+    steppers[s].queueCount = 0;
+    steppers[s].state = state_jog;
+  }
+}
+
+/*
+   Returns true if the stepper stepped, false if not. Stops the state machine
+   when the watchdog expired and the stepper has come to a halt.
+*/
+bool runJog(uint8_t s)
+{
+  Jog* j = steppers[s].jog;
+  bool expired = (j->timeout != 0) and (millis() - j->lastCommand > j->timeout);
+  if (expired) {
+    j->targetSpeed = 0.0;
+  }
+  uint32_t now = micros();
+  if (now - j->lastUpdate >= jogUpdateInterval) {
+    float dv = steppers[s].acceleration * (now - j->lastUpdate) * 1e-6;
+    j->lastUpdate = now;
+    if (j->speed < j->targetSpeed) {
+      j->speed = min(j->speed + dv, j->targetSpeed);
+    } else {
+      j->speed = max(j->speed - dv, j->targetSpeed);
+    }
+    steppers[s].stepper->setSpeed(j->speed);
+    if (expired and (j->speed == 0.0)) {
+      steppers[s].state = state_stopped;
+      return false;
+    }
+  }
+  return steppers[s].stepper->runSpeed();
+}
+
+bool validGroup(int8_t g)
+{
+  return (g >= 0) and (g < numStepperGroups);
+}
+
+/*
+   Start a coordinated move of group g, just like MultiStepper::moveTo() does:
+   the member that takes longest at its max. speed determines the time for the
+   move, all other members get a constant speed so that they arrive at the same
+   time. Then start runSpeedToPosition() polling for all members.
+*/
+void startGroupMove(uint8_t g, long targets[])
+{
+  float longestTime = 0.0;
+  for (uint8_t m = 0; m < stepperGroups[g].numMembers; m++) {
+    AccelStepperType* s = steppers[stepperGroups[g].members[m]].stepper;
+    float thisTime = abs(targets[m] - s->currentPosition()) / s->maxSpeed();
+    if (thisTime > longestTime) {
+      longestTime = thisTime;
+    }
+  }
+  for (uint8_t m = 0; m < stepperGroups[g].numMembers; m++) {
+    uint8_t st = stepperGroups[g].members[m];
+    if (longestTime > 0.0) {
+      float thisSpeed = (targets[m] - steppers[st].stepper->currentPosition()) / longestTime;
+      steppers[st].stepper->moveTo(targets[m]); // moveTo() changes speed, so it needs to come first
+      steppers[st].stepper->setSpeed(thisSpeed);
+      steppers[st].state = state_runSpeedToPosition;
+    }
+    steppers[st].activeGroup = g;
+  }
+  stepperGroups[g].moving = true; // if nobody moved at all, the main loop will report arrival right away
+}
+
+/*
+   Stop all members of group g at their current position, e.g. if one of them hit an endstop.
+*/
+void stopGroup(uint8_t g)
+{
+  for (uint8_t m = 0; m < stepperGroups[g].numMembers; m++) {
+    uint8_t st = stepperGroups[g].members[m];
+    steppers[st].stepper->setSpeed(0);
+    steppers[st].stepper->moveTo(steppers[st].stepper->currentPosition());
+    steppers[st].state = state_stopped;
+    steppers[st].activeGroup = -1;
+  }
+  stepperGroups[g].moving = false;
+}
+
+#if defined(GcodeI2C_h)
+void gcodeStepperStopped(uint8_t s); // defined by GcodeI2C_firmware.h
+#endif // GcodeI2C_h
+
+/*
+   Stop stepper s at its current position, together with its group, if any,
+   and discard its queued segments, which would most likely run into the same
+   obstacle. Used for endstop hits and stalls.
+*/
+void stopStepper(uint8_t s)
+{
+  steppers[s].stepper->setSpeed(0);
+  steppers[s].stepper->moveTo(steppers[s].stepper->currentPosition());
+  steppers[s].state = state_stopped;
+  if (steppers[s].activeGroup >= 0) { // keep the other members from going on on their own
+    stopGroup(steppers[s].activeGroup);
+  }
+  steppers[s].queueCount = 0;
+#if defined(GcodeI2C_h)
+  gcodeStepperStopped(s); // buffered G-code would run from a wrong position now
+#endif // GcodeI2C_h
+}
+
+#if defined(STALL_DETECTION_ENABLED)
+void rebaseStallDetection(uint8_t s); // defined by _stallDetection_firmware.h
+#endif // STALL_DETECTION_ENABLED
+
+/*
+   Set a new current position. Also speed is set to 0, see
+   AccelStepper::setCurrentPosition().
+*/
+void setStepperPosition(uint8_t s, long position)
+{
+  steppers[s].stepper->setCurrentPosition(position);
+#if defined(STALL_DETECTION_ENABLED)
+  rebaseStallDetection(s); // the stepper's position jumps, but the encoder's doesn't
+#endif // STALL_DETECTION_ENABLED
+}
+
+/*
+   Called by the state machine when an endstop was hit while homing.
+*/
+void homingEndstopHit(uint8_t s)
+{
+  switch (steppers[s].homing->phase) {
+    case homingFastApproach:
+      startHomingPhase(s, homingBackOff);
+      break;
+    case homingSlowApproach:
+      setStepperPosition(s, steppers[s].homing->position); // also sets speed to 0
+      steppers[s].state = state_stopped;
+      triggerStepperInterrupt(s, interruptReason_homingDone);
+      break;
+    case homingBackOff: // must be some other endstop, give up
+      stopStepper(s);
+      triggerStepperInterrupt(s, interruptReason_endstopHit);
+      break;
+  }
+}
+
+/*
+   Interrupt controller if interrupts are enabled for any member of group g.
+*/
+void triggerGroupInterrupt(uint8_t g, uint8_t reason)
+{
+  for (uint8_t m = 0; m < stepperGroups[g].numMembers; m++) {
+    if (steppers[stepperGroups[g].members[m]].interruptsEnabled) {
+      triggerInterrupt(g, reason);
+      return;
+    }
+  }
+}
+
+
+/*
+   Benchmark stuff
+*/
+
+#if defined(ACCELSTEPPERI2C_BENCHMARK)
+
+struct StepTimingRecord
+{
+  StepTiming timing;
+  uint32_t lastStep; // time of the last step, 0 = no step yet
+};
+StepTimingRecord* stepTimings = nullptr; // allocated with the first benchmark
+
+bool benchmarkRunning = false;
+uint32_t benchmarkStart = 0;
+uint32_t benchmarkElapsed = 0; // microseconds, valid after the benchmark was stopped
+uint32_t benchmarkCycles = 0; // state machine cycles
+uint32_t benchmarkMaxCycleTime = 0; // longest time between two state machine cycles
+uint32_t benchmarkLastCycle = 0;
+uint32_t benchmarkMessages = 0; // messages processed, valid after the benchmark was stopped
+uint32_t benchmarkFirstMessage = 0;
+
+void startBenchmark()
+{
+  if (stepTimings == nullptr) {
+    stepTimings = new StepTimingRecord[maxSteppers];
+  }
+  for (uint8_t s = 0; s < maxSteppers; s++) {
+    stepTimings[s] = {{0, UINT32_MAX, 0}, 0};
+  }
+  benchmarkCycles = benchmarkMaxCycleTime = benchmarkMessages = 0;
+  benchmarkElapsed = 0;
+  benchmarkFirstMessage = messagesProcessed;
+  benchmarkStart = benchmarkLastCycle = micros();
+  benchmarkRunning = true;
+}
+
+void stopBenchmark()
+{
+  if (benchmarkRunning) {
+    benchmarkElapsed = micros() - benchmarkStart;
+    benchmarkMessages = messagesProcessed - benchmarkFirstMessage;
+    benchmarkRunning = false;
+  }
+}
+
+/*
+   Called for each step of stepper s while the benchmark is running.
+*/
+void recordStep(uint8_t s, uint32_t now)
+{
+  StepTimingRecord* t = &stepTimings[s];
+  if (t->lastStep != 0) {
+    uint32_t interval = now - t->lastStep;
+    t->timing.minInterval = min(t->timing.minInterval, interval);
+    t->timing.maxInterval = max(t->timing.maxInterval, interval);
+  }
+  t->lastStep = now;
+  t->timing.steps++;
+}
+
+#endif // ACCELSTEPPERI2C_BENCHMARK
 
-/*##########################################################################################*/
-/*# MF_STAGE_loop ##########################################################################*/
-/*##########################################################################################*/
 
 /*
    Implements the state machine. Will check for each stepper's state and do the
-   appropriate polling (run() etc.) as needed.
+   appropriate polling (run() etc.) as needed. Called by the main loop, or by
+   its own task if ACCELSTEPPERI2C_DUAL_CORE is defined.
    @todo endstop polling: overhead to check if polling is needed
    (timeToCheckTheEndstops) might cost more than it saves, so maybe just check
    each cycle even if it might be much more often than needed.
-
 */
-
-#if MF_STAGE == MF_STAGE_loop
+void runStateMachine()
+{
 
 #if defined(DEBUG)
-if (reportNow and numSteppers > 0) { //  report state machine states
-  log("  [Steppers]:states =");
-}
+  if (reportNow and numSteppers > 0) { //  report state machine states
+    log("  [Steppers]:states =");
+  }
 #endif // defined(DEBUG)
 
+#if defined(ACCELSTEPPERI2C_BENCHMARK)
+  uint32_t benchmarkNow = micros();
+  if (benchmarkRunning) {
+    benchmarkCycles++;
+    benchmarkMaxCycleTime = max(benchmarkMaxCycleTime, benchmarkNow - benchmarkLastCycle);
+    benchmarkLastCycle = benchmarkNow;
+  }
+#endif // ACCELSTEPPERI2C_BENCHMARK
 
-for (uint8_t i = 0; i < numSteppers; i++) {  // cycle through all defined steppers
+  if (recording) {
+    recordMotion();
+  }
+
+  for (uint8_t i = 0; i < numSteppers; i++) {  // cycle through all defined steppers
+
+    long prevPosition = steppers[i].stepper->currentPosition(); // needed to detect steps
 
 #if defined(DEBUG)
-  if (reportNow) { // report state machine states for this stepper
-    log("  ["); log(i); log("]:"); log(steppers[i].state);
-  }
+    if (reportNow) { // report state machine states for this stepper
+      log("  ["); log(i); log("]:"); log(steppers[i].state);
+    }
 #endif // defined(DEBUG)
 
-  bool timeToCheckTheEndstops = false; // ###todo: change polling to pinchange interrupt
-  // ### do we need this at all? Why not just poll each cycle? It doesn't take very long.
-  switch (steppers[i].state) {
+    bool timeToCheckTheEndstops = false; // ###todo: change polling to pinchange interrupt
+    // ### do we need this at all? Why not just poll each cycle? It doesn't take very long.
+    switch (steppers[i].state) {
 
-    case state_run: // boolean AccelStepper::run
-      if (not steppers[i].stepper->run()) { // target reached?
-        steppers[i].state = state_stopped;
-        triggerStepperInterrupt(i, interruptReason_targetReachedByRun);
-      }
-      timeToCheckTheEndstops = true; // we cannot tell if there was a step, so we'll have to check every time. (one more reason to do it with interrupts)
-      break;
+      case state_run: // boolean AccelStepper::run, or its jerk limited replacement
+        if (not (sCurveActive(i) ? runSCurve(i) : steppers[i].stepper->run())) { // target reached?
+          steppers[i].state = state_stopped;
+          triggerStepperInterrupt(i, interruptReason_targetReachedByRun);
+        }
+        timeToCheckTheEndstops = true; // we cannot tell if there was a step, so we'll have to check every time. (one more reason to do it with interrupts)
+        break;
+
+      case state_runSpeed:  // boolean AccelStepper::runSpeed
+        timeToCheckTheEndstops = steppers[i].stepper->runSpeed(); // true if stepped
+        break;
+
+      case state_runSpeedToPosition:  // boolean AccelStepper::runSpeedToPosition
+        timeToCheckTheEndstops = steppers[i].stepper->runSpeedToPosition();  // true if stepped
+        if (steppers[i].stepper->distanceToGo() == 0) {
+          // target reached, stop polling
+          steppers[i].state = state_stopped;
+          if (steppers[i].activeGroup < 0) { // group members are reported by their group as a whole
+            triggerStepperInterrupt(i, interruptReason_targetReachedByRunSpeedToPosition);
+          }
+        }
+        break;
 
-    case state_runSpeed:  // boolean AccelStepper::runSpeed
-      timeToCheckTheEndstops = steppers[i].stepper->runSpeed(); // true if stepped
-      break;
+      case state_runQueue: // boolean AccelStepper::run, chaining queued segments
+        if ((steppers[i].queueCount > 0) and segmentCanBeChained(i)) {
+          startNextSegment(i);
+        }
+        if (not steppers[i].stepper->run() and (steppers[i].queueCount == 0)) { // last target reached?
+          steppers[i].state = state_stopped;
+          triggerStepperInterrupt(i, interruptReason_targetReachedByRun);
+        }
+        timeToCheckTheEndstops = true;
+        break;
+
+      case state_homing: // runSpeed() towards or away from the endstop
+        timeToCheckTheEndstops = steppers[i].stepper->runSpeed();
+        if ((steppers[i].homing->phase == homingBackOff)
+            and (labs(steppers[i].stepper->currentPosition() - steppers[i].homing->backOffStart) >= steppers[i].homing->backOff)
+            and (pollEndstops(i) == 0)) { // backed off far enough
+          startHomingPhase(i, homingSlowApproach);
+        }
+        break;
 
-    case state_runSpeedToPosition:  // boolean AccelStepper::runSpeedToPosition
-      timeToCheckTheEndstops = steppers[i].stepper->runSpeedToPosition();  // true if stepped
-      if (steppers[i].stepper->distanceToGo() == 0) {
-        // target reached, stop polling
-        steppers[i].state = state_stopped;
-        triggerStepperInterrupt(i, interruptReason_targetReachedByRunSpeedToPosition);
+      case state_jog: // runSpeed() with speed ramped towards the controller's jog speed
+        timeToCheckTheEndstops = runJog(i);
+        break;
+
+      case state_stopped: // do nothing
+        break;
+    } // switch
+
+    if ((steppers[i].numTriggers > 0) and (steppers[i].stepper->currentPosition() != prevPosition)) {
+      checkPositionTriggers(i, prevPosition, steppers[i].stepper->currentPosition());
+    }
+
+#if defined(ACCELSTEPPERI2C_BENCHMARK)
+    if (benchmarkRunning and (steppers[i].stepper->currentPosition() != prevPosition)) {
+      recordStep(i, micros());
+    }
+#endif // ACCELSTEPPERI2C_BENCHMARK
+
+    if (timeToCheckTheEndstops and (steppers[i].endstopsEnabled or (steppers[i].state == state_homing))) { // the stepper (potentially) stepped a step, so let's look at the endstops
+      uint8_t es = pollEndstops(i);
+      if (es != steppers[i].prevEndstopState) { // detect rising *or* falling flank
+        uint32_t ms = millis();
+        if (ms > steppers[i].endstopDebounceEnd) { // primitive debounce: ignore endstops for some ms after each new flank
+          // log("** es: flank detected  \n");
+          steppers[i].endstopDebounceEnd = ms + endstopDebouncePeriod; // set end of debounce period
+          steppers[i].prevEndstopState = es;
+          if ((es != 0) and (steppers[i].state == state_homing)) { // homing handles its endstop hits itself
+            homingEndstopHit(i);
+          } else if (es != 0) { // this is a non-bounce, *rising* flank: stop stepper and trigger interrupt
+            log("   Endstop detected!\n");
+            stopStepper(i); // endstop reached, stop polling
+            triggerStepperInterrupt(i, interruptReason_endstopHit);
+          }
+        }
       }
-      break;
+    } // check endstops
 
-    case state_stopped: // do nothing
-      break;
-  } // switch
-
-  if (timeToCheckTheEndstops and steppers[i].endstopsEnabled) { // the stepper (potentially) stepped a step, so let's look at the endstops
-    uint8_t es = pollEndstops(i);
-    if (es != steppers[i].prevEndstopState) { // detect rising *or* falling flank
-      uint32_t ms = millis();
-      if (ms > steppers[i].endstopDebounceEnd) { // primitive debounce: ignore endstops for some ms after each new flank
-        // log("** es: flank detected  \n");
-        steppers[i].endstopDebounceEnd = ms + endstopDebouncePeriod; // set end of debounce period
-        steppers[i].prevEndstopState = es;
-        if (es != 0) { // this is a non-bounce, *rising* flank: stop stepper and trigger interrupt
-          log("   Endstop detected!\n");
-          //steppers[i].stepper->stop();
-          steppers[i].stepper->setSpeed(0);
-          steppers[i].stepper->moveTo(steppers[i].stepper->currentPosition());
-          steppers[i].state = state_stopped; // endstop reached, stop polling
-          triggerStepperInterrupt(i, interruptReason_endstopHit);
+  } // for
+
+  for (uint8_t g = 0; g < numStepperGroups; g++) { // check for groups that have finished their coordinated move
+    if (stepperGroups[g].moving) {
+      bool arrived = true;
+      for (uint8_t m = 0; m < stepperGroups[g].numMembers; m++) {
+        arrived = arrived and (steppers[stepperGroups[g].members[m]].state == state_stopped);
+      }
+      if (arrived) {
+        for (uint8_t m = 0; m < stepperGroups[g].numMembers; m++) {
+          steppers[stepperGroups[g].members[m]].activeGroup = -1;
         }
+        stepperGroups[g].moving = false;
+        triggerGroupInterrupt(g, interruptReason_groupTargetReached);
       }
     }
-  } // check endstops
+  }
+
+}
+
+
+/*
+   Dual core stuff (ESP32 only). The state machine runs in its own task on
+   core 0, while the Arduino loop() with the message processing and all other
+   modules stays on core 1. A mutex guards the steppers while stepper commands
+   are processed.
+*/
+
+#if defined(ACCELSTEPPERI2C_DUAL_CORE)
+
+const BaseType_t stateMachineCore = 0; // Arduino's loop() runs on core 1
+SemaphoreHandle_t stepperMutex;
+volatile uint8_t stepperLockRequests = 0; // makes the state machine task step aside for message processing
+
+void stateMachineTask(void* parameter)
+{
+  while (true) {
+    xSemaphoreTake(stepperMutex, portMAX_DELAY);
+    runStateMachine();
+    xSemaphoreGive(stepperMutex);
+    while (stepperLockRequests > 0) { // let processMessage() have the mutex, the task would otherwise instantly retake it
+      taskYIELD();
+    }
+  }
+}
+
+/*
+   Commands which touch the steppers, including those of other modules which
+   work on them.
+*/
+bool isStepperCommand(uint8_t cmd)
+{
+  return ((cmd >= asCmdOffset) and (cmd < asCmdOffset + 40))
+         or ((cmd >= asCmdOffset2) and (cmd < asCmdOffset2 + 20))
+#if defined(GcodeI2C_h)
+         or ((cmd >= gcodeCmdOffset) and (cmd < gcodeCmdOffset + 10)) // G-code is interpreted into the steppers' state machines
+#endif // GcodeI2C_h
+         or (cmd == resetCmd);
+}
+
+/*
+   Unconditional lock, for other modules' loop() code that works on steppers.
+*/
+void lockStepperMutex()
+{
+  stepperLockRequests++;
+  xSemaphoreTake(stepperMutex, portMAX_DELAY);
+  stepperLockRequests--;
+}
+
+void unlockStepperMutex()
+{
+  xSemaphoreGive(stepperMutex);
+}
+
+void lockSteppers(uint8_t cmd)
+{
+  if (isStepperCommand(cmd)) {
+    lockStepperMutex();
+  }
+}
+
+void unlockSteppers(uint8_t cmd)
+{
+  if (isStepperCommand(cmd)) {
+    unlockStepperMutex();
+  }
+}
+
+// claim message processing lock for this module
+#ifndef PROCESS_MESSAGE_LOCK_DEFINED_BY_MODULE
+#define PROCESS_MESSAGE_LOCK_DEFINED_BY_MODULE
+#define processMessageLock(cmd) lockSteppers(cmd)
+#define processMessageUnlock(cmd) unlockSteppers(cmd)
+#else
+#error More than one module with a message processing lock enabled in firmware_modules.h. Please deactivate all but one.
+#endif
+
+#endif // ACCELSTEPPERI2C_DUAL_CORE
+
+#endif // MF_STAGE_declarations
+
+
+
+/*##########################################################################################*/
+/*# MF_STAGE_setup #########################################################################*/
+/*##########################################################################################*/
+
+
+
+#if MF_STAGE == MF_STAGE_setup
+log("AccelStepperI2C module enabled.\n");
+#if defined(ACCELSTEPPERI2C_DUAL_CORE)
+stepperMutex = xSemaphoreCreateMutex();
+disableCore0WDT(); // the state machine task never idles, so core 0's idle task won't feed the watchdog
+xTaskCreatePinnedToCore(stateMachineTask, "AccelStepperI2C", 4096, nullptr, 1, nullptr, stateMachineCore);
+log("AccelStepperI2C state machine running on core "); log(stateMachineCore); log(".\n");
+#endif // ACCELSTEPPERI2C_DUAL_CORE
+#endif // MF_STAGE_setup
+
+
+
+
+/*##########################################################################################*/
+/*# MF_STAGE_loop ##########################################################################*/
+/*##########################################################################################*/
+
+#if MF_STAGE == MF_STAGE_loop
+
+#if !defined(ACCELSTEPPERI2C_DUAL_CORE)
+runStateMachine(); // otherwise it runs in its own task
+#endif // ACCELSTEPPERI2C_DUAL_CORE
 
-} // for
 #endif // MF_STAGE_loop
 
 
@@ -302,7 +1315,7 @@ case setAccelerationCmd: { // void   setAcceleration (float acceleration)
   if (validStepper(unit) and (i == 4)) { // 1 float parameter
     float f = 0;
     bufferIn->read(f);
-    steppers[unit].stepper->setAcceleration(f);
+    setStepperAcceleration(unit, f);
   }
 }
 break;
@@ -352,7 +1365,7 @@ case setCurrentPositionCmd: { // void   setCurrentPosition (long position)
   if (validStepper(unit) and (i == 4)) { // 1 long parameter
     long l = 0;
     bufferIn->read(l);
-    steppers[unit].stepper->setCurrentPosition(l);
+    setStepperPosition(unit, l);
   }
 }
 break;
@@ -376,7 +1389,11 @@ break;
 
 case stopCmd: { // void   stop ()
   if (validStepper(unit) and (i == 0)) { // no parameters
-    steppers[unit].stepper->stop();
+    if (sCurveActive(unit) and (steppers[unit].state == state_run)) {
+      stopSCurve(unit);
+    } else {
+      steppers[unit].stepper->stop();
+    }
   }
 }
 break;
@@ -497,7 +1514,12 @@ case setStateCmd: { //
   if (validStepper(unit) and (i == 1)) { // 1 uint8_t
     uint8_t newState;
     bufferIn->read(newState);
-    steppers[unit].state = newState;
+    if ((newState != state_homing) and (newState != state_jog)) { // these need their parameters, see homeCmd and jogCmd
+      if ((newState == state_run) and (steppers[unit].state != state_run) and sCurveActive(unit)) {
+        startSCurve(unit);
+      }
+      steppers[unit].state = newState;
+    }
   }
 }
 break;
@@ -513,6 +1535,9 @@ break;
 
 case setEndstopPinCmd: { //
   if (validStepper(unit) and (i == 3) and (steppers[unit].numEndstops < maxEndstops)) {
+    if (steppers[unit].endstops == nullptr) {
+      steppers[unit].endstops = new Endstop[maxEndstops];
+    }
     int8_t pin; bufferIn->read(pin);
     bool activeLow; bufferIn->read(activeLow);
     bool internalPullup; bufferIn->read(internalPullup);
@@ -544,6 +1569,234 @@ case endstopsCmd: {
 break;
 
 
+case statusSnapshotCmd: { // concerns all steppers, so no unit
+  if (i == 3) { // 1 uint16_t mask, 1 uint8_t first record
+    uint16_t mask = 0; bufferIn->read(mask);
+    uint8_t first = 0; bufferIn->read(first);
+    if (first == 0) {
+      takeStatusSnapshot(mask);
+    }
+    bufferOut->write(numStatusRecords);
+    for (uint8_t r = first; r < first + statusRecordsPerFrame; r++) {
+      writeStatusRecord(r);
+    }
+  }
+}
+break;
+
+
+case homeCmd: {
+  if (validStepper(unit) and (i == 16) and (steppers[unit].numEndstops > 0)) { // 2 float, 2 int32_t
+    float fastSpeed = 0.0; bufferIn->read(fastSpeed);
+    float slowSpeed = 0.0; bufferIn->read(slowSpeed);
+    int32_t backOff = 0; bufferIn->read(backOff);
+    int32_t position = 0; bufferIn->read(position);
+    if ((fastSpeed != 0.0) and (slowSpeed != 0.0)) {
+      startHoming(unit, fastSpeed, slowSpeed, backOff, position);
+    }
+  }
+}
+break;
+
+
+case jogCmd: {
+  if (validStepper(unit) and (i == 4)) { // 1 float
+    float speed = 0.0; bufferIn->read(speed);
+    jog(unit, speed);
+  }
+}
+break;
+
+case setJogTimeoutCmd: {
+  if (validStepper(unit) and (i == 2)) { // 1 uint16_t
+    uint16_t timeout = 0; bufferIn->read(timeout);
+    getJog(unit)->timeout = timeout;
+  }
+}
+break;
+
+case startRecordingCmd: { // concerns all steppers, so no unit
+  if (i == 6) { // 1 uint32_t, 1 uint16_t
+    uint32_t interval = 0; bufferIn->read(interval);
+    uint16_t mask = 0; bufferIn->read(mask);
+    if (interval > 0) {
+      startRecording(interval, mask);
+    }
+  }
+}
+break;
+
+case stopRecordingCmd: {
+  if (i == 0) {
+    recording = false;
+  }
+}
+break;
+
+case motionSamplesCmd: {
+  if (i == 2) { // 1 uint16_t first sample
+    uint16_t first = 0; bufferIn->read(first);
+    if (first == 0) { // samples must not change while being read
+      recording = false;
+    }
+    writeMotionSamples(first);
+  }
+}
+break;
+
+case setJerkCmd: {
+  if (validStepper(unit) and (i == 4)) { // 1 float
+    float jerk = 0.0; bufferIn->read(jerk);
+    setJerk(unit, jerk);
+  }
+}
+break;
+
+case addPositionTriggerCmd: {
+  if (validStepper(unit) and (i == 7)) { // 1 int32_t, 1 int8_t, 1 uint8_t, 1 bool
+    int32_t position = 0; bufferIn->read(position);
+    int8_t pin = -1; bufferIn->read(pin);
+    uint8_t pinAction = 0; bufferIn->read(pinAction);
+    bool interrupt = false; bufferIn->read(interrupt);
+    bufferOut->write(addPositionTrigger(unit, position, pin, pinAction, interrupt));
+  }
+}
+break;
+
+case clearPositionTriggersCmd: {
+  if (validStepper(unit) and (i == 0)) { // no parameters
+    steppers[unit].numTriggers = 0; // keep the memory, it will most likely be reused
+    steppers[unit].firedTriggers = 0;
+  }
+}
+break;
+
+case firedTriggersCmd: {
+  if (validStepper(unit) and (i == 0)) { // no parameters
+    bufferOut->write(steppers[unit].firedTriggers);
+    steppers[unit].firedTriggers = 0;
+  }
+}
+break;
+
+
+/*
+    Motion segment queue commands
+*/
+
+case queueMoveToCmd: {
+  if (validStepper(unit) and (i == 12)) { // 1 int32_t, 2 float
+    int32_t target = 0; bufferIn->read(target);
+    float sp = 0; bufferIn->read(sp);
+    float acc = 0; bufferIn->read(acc);
+    bufferOut->write(queueSegment(unit, target, sp, acc));
+  }
+}
+break;
+
+case queueFreeCmd: {
+  if (validStepper(unit) and (i == 0)) { // no parameters
+    bufferOut->write(int8_t(maxQueueSegments - steppers[unit].queueCount));
+  }
+}
+break;
+
+case clearQueueCmd: {
+  if (validStepper(unit) and (i == 0)) { // no parameters
+    steppers[unit].queueCount = 0;
+  }
+}
+break;
+
+case setQueueLowWaterCmd: {
+  if (validStepper(unit) and (i == 1)) { // 1 uint8_t
+    bufferIn->read(steppers[unit].queueLowWater);
+    steppers[unit].queueLowSignaled = false;
+  }
+}
+break;
+
+
+/*
+    MultiStepperI2C commands
+*/
+
+case addToGroupCmd: { // unit is the stepper to add
+  if (validStepper(unit) and (i == 1)) { // 1 int8_t (group, -1 for new group)
+    int8_t g; bufferIn->read(g);
+    if ((g < 0) and (numStepperGroups < maxStepperGroups)) { // create new group
+      g = numStepperGroups++;
+      stepperGroups[g].numMembers = 0;
+      stepperGroups[g].moving = false;
+      log("Add stepper group with internal myNum = "); log(g); log("\n");
+    }
+    if (validGroup(g) and (stepperGroups[g].numMembers < maxGroupSize)) {
+      stepperGroups[g].members[stepperGroups[g].numMembers++] = unit;
+    } else {
+      g = -1;
+    }
+    bufferOut->write(g);
+  }
+}
+break;
+
+case groupMoveToCmd: { // unit is the group
+  if (validGroup(unit) and (i == stepperGroups[unit].numMembers * 4)) { // 1 int32_t for each member
+    long targets[maxGroupSize];
+    for (uint8_t m = 0; m < stepperGroups[unit].numMembers; m++) {
+      int32_t t = 0; bufferIn->read(t);
+      targets[m] = t;
+    }
+    startGroupMove(unit, targets);
+  }
+}
+break;
+
+
+/*
+    Benchmark commands
+*/
+
+#if defined(ACCELSTEPPERI2C_BENCHMARK)
+
+case benchmarkCmd: { // concerns all steppers, so no unit
+  if (i == 1) { // 1 bool
+    bool start = false; bufferIn->read(start);
+    if (start) {
+      startBenchmark();
+    } else {
+      stopBenchmark();
+    }
+  }
+}
+break;
+
+case stepTimingCmd: {
+  if (validStepper(unit) and (i == 0)) {
+    StepTiming t = {0, 0, 0};
+    if (stepTimings != nullptr) {
+      t = stepTimings[unit].timing;
+    }
+    bufferOut->write(t.steps);
+    bufferOut->write(t.steps > 1 ? t.minInterval : 0); // no interval measured yet
+    bufferOut->write(t.maxInterval);
+  }
+}
+break;
+
+case benchmarkResultCmd: {
+  if (i == 0) {
+    bufferOut->write((uint32_t)(benchmarkRunning ? micros() - benchmarkStart : benchmarkElapsed));
+    bufferOut->write(benchmarkCycles);
+    bufferOut->write(benchmarkMaxCycleTime);
+    bufferOut->write((uint32_t)(benchmarkRunning ? messagesProcessed - benchmarkFirstMessage : benchmarkMessages));
+  }
+}
+break;
+
+#endif // ACCELSTEPPERI2C_BENCHMARK
+
+
 #endif // MF_STAGE_processMessage
 
 
@@ -560,9 +1813,41 @@ for (uint8_t j = 0; j < numSteppers; j++) {
   for (uint8_t k = 0; k < steppers[j].numEndstops; k++) {   // reset endstops
     pinMode(steppers[j].endstops[k].pin, INPUT); // INPUT is Arduino default
   }
+  delete[] steppers[j].endstops;
+  steppers[j].endstops = nullptr;
+  steppers[j].numEndstops = 0;
+  delete[] steppers[j].queue; // nullptr if unused, which is fine
+  steppers[j].queue = nullptr;
+  delete steppers[j].homing; // dto.
+  steppers[j].homing = nullptr;
+  for (uint8_t k = 0; k < steppers[j].numTriggers; k++) { // reset trigger outputs
+    if (steppers[j].triggers[k].pin >= 0) {
+      pinMode(steppers[j].triggers[k].pin, INPUT);
+    }
+  }
+  delete steppers[j].sCurve;
+  steppers[j].sCurve = nullptr;
+  delete steppers[j].jog;
+  steppers[j].jog = nullptr;
+  delete[] steppers[j].triggers;
+  steppers[j].triggers = nullptr;
+  steppers[j].numTriggers = 0;
   delete steppers[j].stepper; // destroy object allocated earlier with new(). Note: will throw a compiler warning, as AccelStepper has no virtual destructor. This is without consequence, as we're not using the class polymorphically.
 }
 numSteppers = 0;
+numStepperGroups = 0;
+delete[] statusSnapshot;
+statusSnapshot = nullptr;
+recording = false;
+delete[] motionSamples;
+motionSamples = nullptr;
+numMotionSamples = 0;
+numStatusRecords = 0;
+#if defined(ACCELSTEPPERI2C_BENCHMARK)
+benchmarkRunning = false;
+delete[] stepTimings;
+stepTimings = nullptr;
+#endif // ACCELSTEPPERI2C_BENCHMARK
 #endif // MF_STAGE_reset
 
 
@@ -0,0 +1,570 @@
+/*!
+    @file GcodeI2C_firmware.h
+    @brief Firmware module for the I2Cwrapper firmare.
+
+    Interprets a small subset of G-code (G0, G1, G28, G90, G91, G92), sent as
+    text lines or as pre-tokenized binary blocks, and plans it into the
+    AccelStepperI2C state machine. Needs the AccelStepperI2C module, which
+    must be included before this one in firmware_modules.h.
+
+    ## Author
+    Copyright (c) 2023 juh
+    ## License
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation, version 2.
+*/
+
+/// @cond
+
+/*
+   (1) includes
+*/
+
+#if MF_STAGE == MF_STAGE_includes
+#include <GcodeI2C.h>
+#endif // MF_STAGE_includes
+
+
+/*
+   (2) declarations
+*/
+
+#if MF_STAGE == MF_STAGE_declarations
+
+#if !defined(AccelStepperI2C_h)
+#error GcodeI2C_firmware.h needs the AccelStepperI2C module, include it before GcodeI2C in firmware_modules.h.
+#endif
+
+#if defined(ARDUINO_ARCH_AVR)
+const uint8_t maxGcodeBlocks = 4;
+const uint8_t maxGcodeLine = 48;
+#else
+const uint8_t maxGcodeBlocks = 16;
+const uint8_t maxGcodeLine = 96;
+#endif
+
+struct GcodeAxis
+{
+  int8_t stepper = -1; // -1 = axis not used
+  float stepsPerUnit = 1.0;
+  float homingFast = 0.0; // units/s, sign gives the direction, 0 = no homing defined
+  float homingSlow = 0.0;
+  float homingBackOff = 0.0; // units
+};
+GcodeAxis gcodeAxes[gcodeNumAxes];
+
+/*
+   A parsed G-code line, with all coordinates already converted to absolute
+   step positions.
+*/
+struct GcodeBlock
+{
+  uint8_t code; // 0, 1, 28, or 92
+  uint8_t axes; // bit mask of the axes concerned
+  long target[gcodeNumAxes]; // steps
+  float feed; // units/s
+};
+GcodeBlock* gcodeBlocks = nullptr; // ring buffer, allocated with the first block
+uint8_t gcodeHead = 0;
+uint8_t gcodeCount = 0;
+GcodeBlock gcodeCurrent; // block being executed
+bool gcodeActive = false; // gcodeCurrent is in progress
+
+// parser state
+bool gcodeAbsolute = true; // G90/G91
+uint8_t gcodeMotion = 0; // modal G0/G1 for lines without G word
+const float gcodeDefaultFeed = 10.0; // units/s
+const float gcodeDefaultRapid = 50.0; // units/s, i.e. 3000 units/min
+const float gcodeDefaultAcceleration = 100.0; // units/s²
+float gcodeFeed = gcodeDefaultFeed;
+float gcodeRapid = gcodeDefaultRapid;
+float gcodeAcceleration = gcodeDefaultAcceleration;
+long gcodePlanned[gcodeNumAxes]; // where the axes will be after the last buffered block
+bool gcodeRejected = false; // a block was rejected since the last reply
+bool gcodeFault = false; // an axis was stopped by an endstop or stall, all blocks are rejected until cleared
+
+char* gcodeLine = nullptr; // allocated with the first text command
+uint8_t gcodeLineLength = 0;
+bool gcodeLineOverflow = false;
+
+
+bool gcodeValidAxis(uint8_t a)
+{
+  return (a < gcodeNumAxes) and (gcodeAxes[a].stepper >= 0) and validStepper(gcodeAxes[a].stepper);
+}
+
+/*
+   An axis can be homed if it has homing speeds set and its stepper has
+   endstops to home to.
+*/
+bool gcodeCanHome(uint8_t a)
+{
+  return gcodeValidAxis(a) and (gcodeAxes[a].homingFast != 0.0) and (steppers[gcodeAxes[a].stepper].numEndstops > 0);
+}
+
+int8_t gcodeFree()
+{
+  return (gcodeRejected or gcodeFault) ? -1 : maxGcodeBlocks - gcodeCount;
+}
+
+long gcodeToSteps(uint8_t a, float v)
+{
+  return lround(v * gcodeAxes[a].stepsPerUnit);
+}
+
+bool gcodeQueue(GcodeBlock& b)
+{
+  if (gcodeBlocks == nullptr) {
+    gcodeBlocks = new GcodeBlock[maxGcodeBlocks];
+  }
+  if (gcodeCount >= maxGcodeBlocks) {
+    return false;
+  }
+  gcodeBlocks[(gcodeHead + gcodeCount++) % maxGcodeBlocks] = b;
+  return true;
+}
+
+/*
+   Interpret one block. values[] holds X, Y, Z, and F in this order, only those
+   flagged in words are valid. Returns false if the block was rejected.
+*/
+bool gcodeInterpret(uint8_t code, uint8_t words, float values[])
+{
+  if (gcodeFault) {
+    return false;
+  }
+  if ((gcodeCount == 0) and not gcodeActive) { // idle, so the steppers might have been moved otherwise
+    for (uint8_t a = 0; a < gcodeNumAxes; a++) {
+      if (gcodeValidAxis(a)) {
+        gcodePlanned[a] = steppers[gcodeAxes[a].stepper].stepper->currentPosition();
+      }
+    }
+  }
+  if ((words & gcodeWordF) and (values[gcodeNumAxes] > 0.0)) {
+    gcodeFeed = values[gcodeNumAxes] / 60.0; // units/min
+  }
+  uint8_t axes = words & (gcodeWordF - 1);
+  for (uint8_t a = 0; a < gcodeNumAxes; a++) {
+    if ((axes & (1 << a)) and not gcodeValidAxis(a)) {
+      return false;
+    }
+  }
+  GcodeBlock b;
+  b.code = code;
+  b.axes = axes;
+  switch (code) {
+    case 0:
+    case 1:
+      gcodeMotion = code;
+      if (axes == 0) { // just a new feed rate
+        return true;
+      }
+      b.feed = code == 0 ? gcodeRapid : gcodeFeed;
+      for (uint8_t a = 0; a < gcodeNumAxes; a++) {
+        b.target[a] = gcodePlanned[a];
+        if (axes & (1 << a)) {
+          b.target[a] = gcodeToSteps(a, values[a]) + (gcodeAbsolute ? 0 : gcodePlanned[a]);
+        }
+      }
+      break;
+    case 28:
+      if (axes == 0) { // home all axes that can be homed
+        for (uint8_t a = 0; a < gcodeNumAxes; a++) {
+          if (gcodeCanHome(a)) {
+            axes |= 1 << a;
+          }
+        }
+        b.axes = axes;
+      }
+      for (uint8_t a = 0; a < gcodeNumAxes; a++) {
+        if (axes & (1 << a)) {
+          if (not gcodeCanHome(a)) {
+            return false;
+          }
+          b.target[a] = 0;
+        }
+      }
+      break;
+    case 90:
+    case 91:
+      gcodeAbsolute = code == 90;
+      return true;
+    case 92:
+      for (uint8_t a = 0; a < gcodeNumAxes; a++) {
+        b.target[a] = gcodePlanned[a];
+        if (axes & (1 << a)) {
+          b.target[a] = gcodeToSteps(a, values[a]);
+        }
+      }
+      break;
+    default: // unsupported G code
+      return false;
+  }
+  if (not gcodeQueue(b)) {
+    return false;
+  }
+  for (uint8_t a = 0; a < gcodeNumAxes; a++) {
+    if (axes & (1 << a)) {
+      gcodePlanned[a] = b.target[a];
+    }
+  }
+  return true;
+}
+
+/*
+   Parse a zero terminated line of text. Returns false if it was rejected.
+*/
+bool gcodeParse(char* p)
+{
+  int16_t code = -1;
+  uint8_t words = 0;
+  float values[gcodeNumAxes + 1];
+  while (*p != '\0') {
+    char c = toupper(*p);
+    if ((c == ' ') or (c == '\t') or (c == '\r')) {
+      p++;
+      continue;
+    }
+    if (c == ';') { // comment up to the end of the line
+      break;
+    }
+    if (c == '(') { // comment up to ')'
+      while ((*p != '\0') and (*p != ')')) {
+        p++;
+      }
+      if (*p == ')') {
+        p++;
+      }
+      continue;
+    }
+    char* end;
+    float v = strtod(p + 1, &end);
+    if (end == p + 1) { // letter without number
+      return false;
+    }
+    p = end;
+    switch (c) {
+      case 'G':
+        if (code >= 0) { // only one G word per line
+          return false;
+        }
+        code = (int16_t)v;
+        break;
+      case 'X': words |= gcodeWordX; values[gcodeAxisX] = v; break;
+      case 'Y': words |= gcodeWordY; values[gcodeAxisY] = v; break;
+      case 'Z': words |= gcodeWordZ; values[gcodeAxisZ] = v; break;
+      case 'F': words |= gcodeWordF; values[gcodeNumAxes] = v; break;
+      case 'N': break; // line numbers are ignored
+      default:
+        return false;
+    }
+  }
+  if (code < 0) {
+    if (words == 0) { // empty line or only comments
+      return true;
+    }
+    code = gcodeMotion; // modal G0/G1
+  }
+  return gcodeInterpret(code, words, values);
+}
+
+/*
+   Start executing gcodeCurrent.
+*/
+void gcodeStart()
+{
+  GcodeBlock* b = &gcodeCurrent;
+  switch (b->code) {
+    case 0:
+    case 1: {
+        float delta[gcodeNumAxes];
+        float length = 0.0;
+        for (uint8_t a = 0; a < gcodeNumAxes; a++) {
+          delta[a] = 0.0;
+          if (b->axes & (1 << a)) {
+            delta[a] = (b->target[a] - steppers[gcodeAxes[a].stepper].stepper->currentPosition()) / gcodeAxes[a].stepsPerUnit;
+            length += delta[a] * delta[a];
+          }
+        }
+        length = sqrt(length);
+        for (uint8_t a = 0; a < gcodeNumAxes; a++) {
+          if (delta[a] != 0.0) { // scale speed and acceleration, so that all axes arrive together
+            uint8_t s = gcodeAxes[a].stepper;
+            float scale = fabs(delta[a] / length * gcodeAxes[a].stepsPerUnit);
+            steppers[s].stepper->setMaxSpeed(b->feed * scale);
+            setStepperAcceleration(s, gcodeAcceleration * scale);
+            steppers[s].stepper->moveTo(b->target[a]);
+            if ((steppers[s].state != state_run) and sCurveActive(s)) {
+              startSCurve(s);
+            }
+            steppers[s].state = state_run;
+          }
+        }
+      }
+      break;
+    case 28:
+      for (uint8_t a = 0; a < gcodeNumAxes; a++) {
+        uint8_t s = gcodeAxes[a].stepper;
+        if ((b->axes & (1 << a)) and (steppers[s].numEndstops > 0)) {
+          float spu = fabs(gcodeAxes[a].stepsPerUnit);
+          startHoming(s, gcodeAxes[a].homingFast * gcodeAxes[a].stepsPerUnit, gcodeAxes[a].homingSlow * spu,
+                      lround(gcodeAxes[a].homingBackOff * spu), 0);
+        }
+      }
+      break;
+    case 92:
+      for (uint8_t a = 0; a < gcodeNumAxes; a++) {
+        if (b->axes & (1 << a)) {
+          setStepperPosition(gcodeAxes[a].stepper, b->target[a]);
+        }
+      }
+      break;
+  }
+}
+
+bool gcodeCurrentDone()
+{
+  for (uint8_t a = 0; a < gcodeNumAxes; a++) {
+    if ((gcodeCurrent.axes & (1 << a)) and (steppers[gcodeAxes[a].stepper].state != state_stopped)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void gcodeClear()
+{
+  gcodeCount = 0;
+  gcodeLineLength = 0;
+  gcodeLineOverflow = false;
+  gcodeRejected = false;
+  gcodeFault = false;
+}
+
+/*
+   Called by AccelStepperI2C_firmware.h when a stepper was stopped by an
+   endstop or stall. If it's one of our axes, stop the others, too, flush the
+   buffer and reject everything until the controller clears the fault.
+*/
+void gcodeStepperStopped(uint8_t s)
+{
+  if (gcodeFault or (not gcodeActive and (gcodeCount == 0))) {
+    return;
+  }
+  bool ours = false;
+  for (uint8_t a = 0; a < gcodeNumAxes; a++) {
+    ours = ours or (gcodeValidAxis(a) and (gcodeAxes[a].stepper == s));
+  }
+  if (not ours) {
+    return;
+  }
+  log("-- G-code aborted\n");
+  gcodeFault = true; // before stopping the other axes, which calls us again
+  gcodeCount = 0;
+  for (uint8_t a = 0; a < gcodeNumAxes; a++) {
+    if (gcodeValidAxis(a) and (steppers[gcodeAxes[a].stepper].state != state_stopped)) {
+      stopStepper(gcodeAxes[a].stepper);
+    }
+  }
+}
+
+#endif // MF_STAGE_declarations
+
+
+/*
+   (3) setup() function
+*/
+
+#if MF_STAGE == MF_STAGE_setup
+log("GcodeI2C module enabled.\n");
+#endif // MF_STAGE_setup
+
+
+/*
+   (4) main loop() function
+*/
+
+#if MF_STAGE == MF_STAGE_loop
+if (gcodeActive or (gcodeCount > 0)) {
+#if defined(ACCELSTEPPERI2C_DUAL_CORE)
+  lockStepperMutex(); // the state machine runs on the other core
+#endif // ACCELSTEPPERI2C_DUAL_CORE
+  if (gcodeActive and gcodeCurrentDone()) {
+    gcodeActive = false;
+  }
+  if (not gcodeActive and (gcodeCount > 0)) {
+    gcodeCurrent = gcodeBlocks[gcodeHead];
+    gcodeHead = (gcodeHead + 1) % maxGcodeBlocks;
+    gcodeCount--;
+    gcodeStart();
+    gcodeActive = true;
+  }
+#if defined(ACCELSTEPPERI2C_DUAL_CORE)
+  unlockStepperMutex();
+#endif // ACCELSTEPPERI2C_DUAL_CORE
+}
+#endif // MF_STAGE_loop
+
+
+/*
+   (5) processMessage() function
+*/
+
+#if MF_STAGE == MF_STAGE_processMessage
+
+case gcodeSetAxisCmd: {
+  if (i == 6) { // 1 uint8_t, 1 int8_t, 1 float
+    uint8_t axis = 0; bufferIn->read(axis);
+    int8_t stepper = -1; bufferIn->read(stepper);
+    float stepsPerUnit = 1.0; bufferIn->read(stepsPerUnit);
+    if ((axis < gcodeNumAxes) and validStepper(stepper) and (stepsPerUnit != 0.0)) {
+      gcodeAxes[axis].stepper = stepper;
+      gcodeAxes[axis].stepsPerUnit = stepsPerUnit;
+      gcodePlanned[axis] = steppers[stepper].stepper->currentPosition();
+    }
+  }
+}
+break;
+
+case gcodeSetHomingCmd: {
+  if (i == 13) { // 1 uint8_t, 3 float
+    uint8_t axis = 0; bufferIn->read(axis);
+    if (axis < gcodeNumAxes) {
+      bufferIn->read(gcodeAxes[axis].homingFast);
+      bufferIn->read(gcodeAxes[axis].homingSlow);
+      bufferIn->read(gcodeAxes[axis].homingBackOff);
+    }
+  }
+}
+break;
+
+case gcodeSetMotionCmd: {
+  if (i == 8) { // 2 float
+    float rapid = 0.0; bufferIn->read(rapid);
+    float acceleration = 0.0; bufferIn->read(acceleration);
+    if (rapid > 0.0) {
+      gcodeRapid = rapid / 60.0; // units/min
+    }
+    if (acceleration > 0.0) {
+      gcodeAcceleration = acceleration;
+    }
+  }
+}
+break;
+
+case gcodeLineCmd: {
+  if (i > 0) { // any number of chars
+    if (gcodeLine == nullptr) {
+      gcodeLine = new char[maxGcodeLine];
+    }
+    for (uint8_t k = 0; k < i; k++) {
+      char c = 0; bufferIn->read(c);
+      if (c == '\n') { // line complete
+        gcodeLine[gcodeLineLength] = '\0';
+        if (gcodeLineOverflow or not gcodeParse(gcodeLine)) {
+          log("-- G-code line rejected\n");
+          gcodeRejected = true;
+        }
+        gcodeLineLength = 0;
+        gcodeLineOverflow = false;
+      } else if (gcodeLineLength < maxGcodeLine - 1) {
+        gcodeLine[gcodeLineLength++] = c;
+      } else {
+        gcodeLineOverflow = true;
+      }
+    }
+    bufferOut->write(gcodeFree());
+    gcodeRejected = false;
+  }
+}
+break;
+
+case gcodeBlockCmd: {
+  if ((i >= 2) and ((i - 2) % 4 == 0)) { // 2 uint8_t, n float
+    uint8_t code = 0; bufferIn->read(code);
+    uint8_t words = 0; bufferIn->read(words);
+    float values[gcodeNumAxes + 1];
+    uint8_t numValues = 0;
+    for (uint8_t w = 0; w <= gcodeNumAxes; w++) {
+      if (words & (1 << w)) {
+        if (4 * ++numValues <= i - 2) {
+          bufferIn->read(values[w]);
+        }
+      }
+    }
+    if ((4 * numValues != i - 2) or not gcodeInterpret(code, words, values)) {
+      gcodeRejected = true;
+    }
+    bufferOut->write(gcodeFree());
+    gcodeRejected = false;
+  }
+}
+break;
+
+case gcodeStatusCmd: {
+  if (i == 0) { // no parameters
+    bufferOut->write(int8_t(gcodeFault ? -1 : maxGcodeBlocks - gcodeCount));
+    bufferOut->write((bool)((gcodeCount == 0) and not (gcodeActive and not gcodeCurrentDone())));
+  }
+}
+break;
+
+case gcodeClearCmd: {
+  if (i == 0) { // no parameters
+    gcodeClear();
+  }
+}
+break;
+
+#endif // MF_STAGE_processMessage
+
+
+/*
+   (6) reset event
+*/
+
+#if MF_STAGE == MF_STAGE_reset
+gcodeClear();
+gcodeActive = false;
+gcodeAbsolute = true;
+gcodeMotion = 0;
+gcodeFeed = gcodeDefaultFeed;
+gcodeRapid = gcodeDefaultRapid;
+gcodeAcceleration = gcodeDefaultAcceleration;
+for (uint8_t a = 0; a < gcodeNumAxes; a++) {
+  gcodeAxes[a].stepper = -1;
+  gcodeAxes[a].homingFast = 0.0;
+}
+delete[] gcodeBlocks;
+gcodeBlocks = nullptr;
+delete[] gcodeLine;
+gcodeLine = nullptr;
+#endif // MF_STAGE_reset
+
+
+/*
+   (7) (end of) receiveEvent()
+*/
+
+#if MF_STAGE == MF_STAGE_receiveEvent
+#endif // MF_STAGE_receiveEvent
+
+
+/*
+   (8) (end of) requestEvent()
+*/
+
+#if MF_STAGE == MF_STAGE_requestEvent
+#endif // MF_STAGE_requestEvent
+
+
+/*
+   (9) Change of I2C state machine's state
+*/
+
+#if MF_STAGE == MF_STAGE_I2CstateChange
+#endif // MF_STAGE_I2CstateChange
+
+
+/// @endcond
@@ -33,6 +33,111 @@
 uint8_t usedPins[NUM_DIGITAL_PINS]; // number of available pins on this platform
 uint8_t numUsedPins = 0;
 
+
+/*
+   Pin capture, ring buffer allocated on first use
+*/
+
+#if defined(ARDUINO_ARCH_AVR)
+const uint16_t maxCaptureSamples = 48;
+#else
+const uint16_t maxCaptureSamples = 1024;
+#endif
+
+CaptureSample* captureSamples = nullptr;
+uint16_t captureSamplesHead = 0; // oldest sample
+uint16_t numCaptureSamples = 0;
+uint8_t captureState = captureIdle;
+uint8_t capturePins[maxCapturePins];
+uint8_t numCapturePins;
+uint32_t captureInterval; // microseconds, 0 = sample on change
+uint32_t captureStart;
+uint32_t lastCapture;
+uint8_t lastCapturePins;
+uint8_t captureTriggerMask = 0; // 0 = trigger right away
+uint8_t captureTriggerValue = 0;
+uint16_t capturePostTrigger = maxCaptureSamples; // samples to take from the trigger on
+uint16_t captureRemaining;
+bool captureInterruptsEnabled = false; // for interruptReason_captureDone
+
+void startCapture(uint32_t interval)
+{
+  if (captureSamples == nullptr) {
+    captureSamples = new CaptureSample[maxCaptureSamples];
+  }
+  captureSamplesHead = numCaptureSamples = 0;
+  captureInterval = interval;
+  captureStart = lastCapture = micros() - interval; // first sample right away
+  captureRemaining = capturePostTrigger;
+  captureState = captureWaiting;
+}
+
+uint8_t readCapturePins()
+{
+  uint8_t pins = 0;
+  for (uint8_t p = 0; p < numCapturePins; p++) {
+    if (digitalRead(capturePins[p]) == HIGH) {
+      pins |= 1 << p;
+    }
+  }
+  return pins;
+}
+
+/*
+   Sample the capture pins every captureInterval, or whenever they change.
+   The ring buffer keeps the latest samples before the trigger, from the
+   trigger on, capturePostTrigger more samples are taken.
+*/
+void capture()
+{
+  uint32_t now = micros();
+  uint8_t pins = readCapturePins();
+  if (captureInterval > 0) {
+    if (now - lastCapture < captureInterval) {
+      return;
+    }
+    lastCapture += captureInterval;
+    if (now - lastCapture >= captureInterval) { // we're lagging behind, don't try to catch up
+      lastCapture = now;
+    }
+  } else if ((numCaptureSamples > 0) and (pins == lastCapturePins)) {
+    return;
+  }
+  lastCapturePins = pins;
+  if ((captureState == captureWaiting) and ((pins & captureTriggerMask) == captureTriggerValue)) {
+    captureState = captureTriggered;
+  }
+  CaptureSample* c;
+  if (numCaptureSamples < maxCaptureSamples) {
+    c = &captureSamples[(captureSamplesHead + numCaptureSamples++) % maxCaptureSamples];
+  } else { // full, overwrite oldest
+    c = &captureSamples[captureSamplesHead];
+    captureSamplesHead = (captureSamplesHead + 1) % maxCaptureSamples;
+  }
+  c->time = now - captureStart - captureInterval;
+  c->pins = pins;
+  if ((captureState == captureTriggered) and (--captureRemaining == 0)) {
+    captureState = captureDone;
+    if (captureInterruptsEnabled) {
+      triggerInterrupt(0, interruptReason_captureDone);
+    }
+  }
+}
+
+/*
+   Write sample r (0 = oldest) to the output buffer. Samples beyond the end
+   are sent as zeros, to keep the reply's length fixed.
+*/
+void writeCaptureSample(uint16_t r)
+{
+  CaptureSample c = {0, 0};
+  if (r < numCaptureSamples) {
+    c = captureSamples[(captureSamplesHead + r) % maxCaptureSamples];
+  }
+  bufferOut->write(c.time);
+  bufferOut->write(c.pins);
+}
+
 #endif
 
 
@@ -50,6 +155,9 @@ log("PinI2C module enabled.\n");
 */
 
 #if MF_STAGE == MF_STAGE_loop
+if ((captureState == captureWaiting) or (captureState == captureTriggered)) {
+  capture();
+}
 #endif
 
 
@@ -105,6 +213,57 @@ case pinAnalogWriteCmd: {
 }
 break;
 
+case pinStartCaptureCmd: {
+  if ((i >= 5) and (i <= 4 + maxCapturePins)) { // 1 uint32_t, 1 to maxCapturePins uint8_t
+    uint32_t interval = 0; bufferIn->read(interval);
+    numCapturePins = i - 4;
+    for (uint8_t p = 0; p < numCapturePins; p++) {
+      bufferIn->read(capturePins[p]);
+    }
+    startCapture(interval);
+  }
+}
+break;
+
+case pinCaptureTriggerCmd: {
+  if (i == 4) { // 2 uint8_t, 1 uint16_t
+    bufferIn->read(captureTriggerMask);
+    bufferIn->read(captureTriggerValue);
+    uint16_t postTrigger = maxCaptureSamples; bufferIn->read(postTrigger);
+    capturePostTrigger = postTrigger > maxCaptureSamples ? maxCaptureSamples : (postTrigger > 0 ? postTrigger : 1);
+  }
+}
+break;
+
+case pinEnableCaptureInterruptsCmd: {
+  if (i == 1) { // 1 bool
+    bufferIn->read(captureInterruptsEnabled);
+  }
+}
+break;
+
+case pinCaptureSamplesCmd: {
+  if (i == 2) { // 1 uint16_t first sample
+    uint16_t first = 0; bufferIn->read(first);
+    if ((first == 0) and (captureState != captureDone)) { // samples must not change while being read
+      captureState = captureIdle;
+    }
+    bufferOut->write(numCaptureSamples);
+    for (uint16_t r = first; r < first + captureSamplesPerFrame; r++) {
+      writeCaptureSample(r);
+    }
+  }
+}
+break;
+
+case pinCaptureStateCmd: {
+  if (i == 0) {
+    bufferOut->write(captureState);
+    bufferOut->write(numCaptureSamples);
+  }
+}
+break;
+
 #if defined(ARDUINO_ARCH_AVR) || defined(ARDUINO_ARCH_SAMD) // ESPs don't have analogReference()
 case pinAnalogReferenceCmd: {
   if (i == 1) { //1 uint8_t
@@ -134,5 +293,12 @@ for (uint8_t i = 0; i < numUsedPins; i++) {
   pinMode(usedPins[i], INPUT); // pin default state (https://www.arduino.cc/en/Tutorial/Foundations/DigitalPins), will also turn it off, if it was high output before
 }
 numUsedPins = 0;
+delete[] captureSamples;
+captureSamples = nullptr;
+numCaptureSamples = 0;
+captureState = captureIdle;
+captureTriggerMask = captureTriggerValue = 0;
+capturePostTrigger = maxCaptureSamples;
+captureInterruptsEnabled = false;
 
 #endif // MF_STAGE_reset
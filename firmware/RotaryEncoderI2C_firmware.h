@@ -17,6 +17,9 @@
 
 */
 #if MF_STAGE == MF_STAGE_includes
+
+// #define ROTARYENCODERI2C_INTERRUPTS // uncomment to decode encoders in pin interrupts instead of polling them in loop()
+
 #include <RotaryEncoderI2C.h>
 #endif // MF_STAGE_includes
 
@@ -40,19 +43,305 @@ uint8_t numRotaryEncoders = 0; // number of initialised encoders
 //RotaryEncoder* encoders[maxRotaryEncoders];
 //uint8_t encoderPins[maxRotaryEncoders][2];
 
+/*
+   Position window and count interval which make an encoder interrupt the
+   controller, allocated with the first setWindow or setCountInterval command
+*/
+struct EncoderWatch {
+  bool window = false;
+  long lower;
+  long upper;
+  int8_t zone; // -1 below, 0 inside, 1 above the window
+  uint16_t countInterval = 0; // 0 = off
+  long countReference; // position when the count interval was set
+  long countStep; // number of intervals the position is away from the reference, rounded down
+};
+
+/*
+   Velocity estimation, allocated with the first getVelocity or
+   setVelocityWindow command
+*/
+struct EncoderVelocity {
+  uint32_t window = 10000; // µs
+  uint32_t windowStart; // micros() when the current window started
+  long refPosition; // position and time of the last change of position at the end of the last window with counts
+  uint32_t refTime;
+  int32_t velocity = 0; // counts/s, fixed point with encoderVelocityFractionBits
+};
+
 struct AttachedEncoder {
   RotaryEncoder* encoder;
   uint8_t pin1;
   uint8_t pin2;
+  bool interruptDriven = false; // false: polled in loop()
+  uint32_t lastChange; // micros() of the last change of position
+  int8_t lastDirection; // direction of the last change of position, as RotaryEncoder::Direction
+  EncoderWatch* watch = nullptr; // allocated on first use
+  EncoderVelocity* velocity = nullptr; // allocated on first use
 };
 AttachedEncoder encoders[maxRotaryEncoders];
 
+/*
+   Encoder snapshot, allocated on first use
+*/
+
+EncoderStatus* encoderSnapshot = nullptr;
+uint8_t numEncoderRecords = 0;
+
+/*
+   ESP cores want ISRs in IRAM, ESP8266's attachInterrupt() even refuses
+   others. This goes for tickEncoder(), too, which is called by the ISRs.
+*/
+#if defined(ROTARYENCODERI2C_INTERRUPTS) && (defined(ARDUINO_ARCH_ESP32) || defined(ARDUINO_ARCH_ESP8266))
+#define ROTARYENCODERI2C_ISR IRAM_ATTR
+#else
+#define ROTARYENCODERI2C_ISR
+#endif
+
+/*
+   Let the library decode the pins and remember when and in which direction
+   the position last changed. RotaryEncoder::getDirection() can't be used for
+   that, as it only reports the change since it was last called.
+*/
+void ROTARYENCODERI2C_ISR tickEncoder(uint8_t e)
+{
+  long oldPosition = encoders[e].encoder->getPosition();
+  encoders[e].encoder->tick();
+  long newPosition = encoders[e].encoder->getPosition();
+  if (newPosition != oldPosition) {
+    encoders[e].lastChange = micros();
+    encoders[e].lastDirection = int8_t(newPosition > oldPosition ? RotaryEncoder::Direction::CLOCKWISE
+                                                                 : RotaryEncoder::Direction::COUNTERCLOCKWISE);
+  }
+}
+
+#if defined(ROTARYENCODERI2C_INTERRUPTS)
+
+// the encoders' state may change in an ISR at any time
+#define encoderLock() noInterrupts()
+#define encoderUnlock() interrupts()
+
+/*
+   attachInterrupt() needs plain functions, so each encoder gets its own ISR.
+   RotaryEncoder::tick() reads both pins and looks up the transition in its
+   state table, so it can be called directly from the ISR, just like the
+   library's own ESP examples do. The library code itself stays in flash,
+   though, so the ISRs must not call it while the flash cache is disabled.
+   Code that writes to flash (see _addressFromFlash_firmware.h) needs to
+   suspend them with suspendEncoderISRs(), ticks during that time are lost.
+*/
+volatile bool encoderISRsSuspended = false;
+
+template <uint8_t e> void ROTARYENCODERI2C_ISR encoderISR()
+{
+  if ((e < maxRotaryEncoders) and not diagnosticsMode and not encoderISRsSuspended) {
+    tickEncoder(e);
+  }
+}
+
+void suspendEncoderISRs(bool suspend)
+{
+  encoderISRsSuspended = suspend;
+}
+void (* const encoderISRs[8])() = {encoderISR<0>, encoderISR<1>, encoderISR<2>, encoderISR<3>,
+                                   encoderISR<4>, encoderISR<5>, encoderISR<6>, encoderISR<7>};
+
+/*
+   Encoders with both pins interrupt capable are decoded in their ISR, all
+   others are still polled in loop().
+*/
+void attachEncoderInterrupts(uint8_t e)
+{
+  int i1 = digitalPinToInterrupt(encoders[e].pin1);
+  int i2 = digitalPinToInterrupt(encoders[e].pin2);
+  encoders[e].interruptDriven = (i1 != NOT_AN_INTERRUPT) and (i2 != NOT_AN_INTERRUPT);
+  if (encoders[e].interruptDriven) {
+    attachInterrupt(i1, encoderISRs[e], CHANGE);
+    attachInterrupt(i2, encoderISRs[e], CHANGE);
+  }
+}
+
+#else
+
+#define encoderLock()
+#define encoderUnlock()
+
+#endif // ROTARYENCODERI2C_INTERRUPTS
+
+long encoderPosition(uint8_t e)
+{
+  encoderLock();
+  long p = encoders[e].encoder->getPosition();
+  encoderUnlock();
+  return p;
+}
+
 
 bool validEncoder(int8_t u)
 {
   return (u >= 0) and (u < numRotaryEncoders);
 }
 
+EncoderWatch* getWatch(uint8_t e)
+{
+  if (encoders[e].watch == nullptr) {
+    encoders[e].watch = new EncoderWatch;
+  }
+  return encoders[e].watch;
+}
+
+int8_t windowZone(EncoderWatch* w, long position)
+{
+  return position < w->lower ? -1 : (position > w->upper ? 1 : 0);
+}
+
+long countStep(EncoderWatch* w, long position)
+{
+  long d = position - w->countReference;
+  long n = w->countInterval;
+  return d >= 0 ? d / n : -((n - 1 - d) / n); // round towards -infinity, so that there's no double sized step around the reference
+}
+
+/*
+   Called from loop(), not from the encoder ISRs, so that interrupts are
+   raised in the same context as those of other modules.
+*/
+void checkWatch(uint8_t e)
+{
+  EncoderWatch* w = encoders[e].watch;
+  long position = encoderPosition(e);
+  if (w->window) {
+    int8_t zone = windowZone(w, position);
+    if (zone != w->zone) {
+      w->zone = zone;
+      triggerInterrupt(e, interruptReason_encoderWindow);
+    }
+  }
+  if (w->countInterval > 0) {
+    long step = countStep(w, position);
+    if (step != w->countStep) {
+      w->countStep = step;
+      triggerInterrupt(e, interruptReason_encoderCount);
+    }
+  }
+}
+
+/*
+   Start a new velocity window at the encoder's current position. Its
+   timestamp is that of the last change of position, not now, as that's
+   when the encoder actually was there.
+*/
+void restartVelocityWindow(uint8_t e)
+{
+  EncoderVelocity* v = encoders[e].velocity;
+  encoderLock();
+  v->refPosition = encoders[e].encoder->getPosition();
+  v->refTime = encoders[e].lastChange;
+  encoderUnlock();
+  v->windowStart = micros();
+}
+
+EncoderVelocity* getVelocity(uint8_t e)
+{
+  if (encoders[e].velocity == nullptr) {
+    encoders[e].velocity = new EncoderVelocity;
+    restartVelocityWindow(e);
+  }
+  return encoders[e].velocity;
+}
+
+/*
+   Velocity is the number of counts since the last window with counts,
+   divided by the exact time between their first and last change of position
+   (M/T method). So at high speed, it's averaged over all counts of a window,
+   and at low speed, when there's less than one count per window, it's the
+   period of the last count. Without counts, the velocity can't be higher
+   than one count in the time since the last one, so it decays until that
+   time exceeds one second.
+*/
+void updateVelocity(uint8_t e)
+{
+  EncoderVelocity* v = encoders[e].velocity;
+  uint32_t now = micros();
+  if (now - v->windowStart < v->window) {
+    return;
+  }
+  v->windowStart = now;
+  encoderLock();
+  long position = encoders[e].encoder->getPosition();
+  uint32_t lastChange = encoders[e].lastChange;
+  encoderUnlock();
+  const int64_t scale = 1000000LL << encoderVelocityFractionBits; // µs -> s
+  long counts = position - v->refPosition;
+  uint32_t dt = lastChange - v->refTime;
+  if ((counts != 0) and (dt > 0)) {
+    v->velocity = int32_t(counts * scale / (int64_t)dt);
+    v->refPosition = position;
+    v->refTime = lastChange;
+  } else {
+    dt = now - v->refTime;
+    if (dt > 1000000UL) {
+      v->velocity = 0;
+    } else if (dt > 0) {
+      int32_t limit = int32_t(scale / (int64_t)dt);
+      if (v->velocity > limit) {
+        v->velocity = limit;
+      } else if (v->velocity < -limit) {
+        v->velocity = -limit;
+      }
+    }
+  }
+}
+
+/*
+   Take a snapshot of all encoders selected by mask, so that all values
+   returned by subsequent rotaryEncoderSnapshotCmds stem from the same moment.
+*/
+void takeEncoderSnapshot(uint8_t mask)
+{
+  if (encoderSnapshot == nullptr) {
+    encoderSnapshot = new EncoderStatus[maxRotaryEncoders];
+  }
+  numEncoderRecords = 0;
+  encoderLock(); // no ticks in between
+  for (uint8_t e = 0; e < numRotaryEncoders; e++) {
+    if (mask & (1 << e)) {
+      EncoderStatus* st = &encoderSnapshot[numEncoderRecords++];
+      st->encoder = e;
+      st->direction = (RotaryEncoder::Direction)encoders[e].lastDirection;
+      st->position = encoders[e].encoder->getPosition();
+      st->lastChange = encoders[e].lastChange;
+    }
+  }
+  encoderUnlock();
+}
+
+/*
+   Write snapshot record r to the output buffer, with the direction packed
+   into the encoder number's upper bits. Records beyond the end of the
+   snapshot are sent as zeros, to keep the reply's length fixed.
+*/
+void writeEncoderRecord(uint8_t r)
+{
+  uint8_t encoderAndDirection = 0;
+  int32_t position = 0;
+  uint32_t lastChange = 0;
+  if (r < numEncoderRecords) {
+    EncoderStatus* st = &encoderSnapshot[r];
+    encoderAndDirection = st->encoder;
+    if (st->direction == RotaryEncoder::Direction::CLOCKWISE) {
+      encoderAndDirection |= encoderRecordClockwise;
+    } else if (st->direction == RotaryEncoder::Direction::COUNTERCLOCKWISE) {
+      encoderAndDirection |= encoderRecordCounterclockwise;
+    }
+    position = st->position;
+    lastChange = st->lastChange;
+  }
+  bufferOut->write(encoderAndDirection);
+  bufferOut->write(position);
+  bufferOut->write(lastChange);
+}
+
 
 
 #endif // MF_STAGE_declarations
@@ -75,7 +364,15 @@ log("RotaryEncoderI2C module enabled.\n");
 
 if (not diagnosticsMode) {
   for (uint8_t enc = 0; enc < numRotaryEncoders; enc++) {
-    encoders[enc].encoder->tick();
+    if (not encoders[enc].interruptDriven) {
+      tickEncoder(enc);
+    }
+    if (encoders[enc].watch != nullptr) {
+      checkWatch(enc);
+    }
+    if (encoders[enc].velocity != nullptr) {
+      updateVelocity(enc);
+    }
   }
 }
 
@@ -98,6 +395,14 @@ case rotaryEncoderAttachCmd : {
       encoders[numRotaryEncoders].encoder = new RotaryEncoder((int)pin1, (int)pin2, (RotaryEncoder::LatchMode)mode);
       encoders[numRotaryEncoders].pin1 = uint8_t(pin1);
       encoders[numRotaryEncoders].pin2 = uint8_t(pin2);
+      encoders[numRotaryEncoders].interruptDriven = false;
+      encoders[numRotaryEncoders].lastChange = micros();
+      encoders[numRotaryEncoders].lastDirection = 0;
+      encoders[numRotaryEncoders].watch = nullptr;
+      encoders[numRotaryEncoders].velocity = nullptr;
+#if defined(ROTARYENCODERI2C_INTERRUPTS)
+      attachEncoderInterrupts(numRotaryEncoders);
+#endif // ROTARYENCODERI2C_INTERRUPTS
       log("Add rotary encoder with internal myNum = "); log(numRotaryEncoders); log("\n");
       res = numRotaryEncoders++;
     } else {
@@ -111,14 +416,17 @@ break;
 
 case rotaryEncoderGetPositionCmd : {
   if ((i == 0) and validEncoder(unit)) {
-    bufferOut->write((int32_t)encoders[unit].encoder->getPosition());
+    bufferOut->write((int32_t)encoderPosition(unit));
   }
 }
 break;
 
 case rotaryEncoderGetDirectionCmd : {
   if ((i == 0) and validEncoder(unit)) {
-    bufferOut->write((int8_t)encoders[unit].encoder->getDirection());
+    encoderLock();
+    int8_t direction = (int8_t)encoders[unit].encoder->getDirection();
+    encoderUnlock();
+    bufferOut->write(direction);
   }
 }
 break;
@@ -126,21 +434,32 @@ break;
 case rotaryEncoderSetPositionCmd : {
   if ((i == 4) and validEncoder(unit)) {
     uint32_t newPosition = 0; bufferIn->read(newPosition);
+    encoderLock();
     encoders[unit].encoder->setPosition((long)newPosition);
+    encoderUnlock();
+    if (encoders[unit].velocity != nullptr) { // don't take the jump for a movement
+      restartVelocityWindow(unit);
+    }
   }
 }
 break;
 
 case rotaryEncoderGetMillisBetweenRotationsCmd : {
   if ((i == 0) and validEncoder(unit)) {
-    bufferOut->write((unsigned long)encoders[unit].encoder->getMillisBetweenRotations());
+    encoderLock();
+    unsigned long ms = encoders[unit].encoder->getMillisBetweenRotations();
+    encoderUnlock();
+    bufferOut->write(ms);
   }
 }
 break;
 
 case rotaryEncoderGetRPMCmd : {
   if ((i == 0) and validEncoder(unit)) {
-    bufferOut->write((unsigned long)encoders[unit].encoder->getRPM());
+    encoderLock();
+    unsigned long rpm = encoders[unit].encoder->getRPM();
+    encoderUnlock();
+    bufferOut->write(rpm);
   }
 }
 break;
@@ -153,6 +472,60 @@ case rotaryEncoderStartDiagnosticsModeCmd : {
 }
 break;
 
+case rotaryEncoderSetWindowCmd : {
+  if ((i == 8) and validEncoder(unit)) { // 2 int32_t
+    int32_t lower = 0; bufferIn->read(lower);
+    int32_t upper = 0; bufferIn->read(upper);
+    EncoderWatch* w = getWatch(unit);
+    w->window = lower <= upper; // else switch it off
+    w->lower = lower;
+    w->upper = upper;
+    w->zone = windowZone(w, encoderPosition(unit)); // no interrupt for where we are now
+  }
+}
+break;
+
+case rotaryEncoderSetCountIntervalCmd : {
+  if ((i == 2) and validEncoder(unit)) { // 1 uint16_t
+    uint16_t counts = 0; bufferIn->read(counts);
+    EncoderWatch* w = getWatch(unit);
+    w->countInterval = counts; // 0 switches it off
+    w->countReference = encoderPosition(unit);
+    w->countStep = 0;
+  }
+}
+break;
+
+case rotaryEncoderGetVelocityCmd : {
+  if ((i == 0) and validEncoder(unit)) {
+    bufferOut->write(getVelocity(unit)->velocity);
+  }
+}
+break;
+
+case rotaryEncoderSetVelocityWindowCmd : {
+  if ((i == 2) and validEncoder(unit)) { // 1 uint16_t
+    uint16_t window = 10; bufferIn->read(window);
+    getVelocity(unit)->window = uint32_t(window > 0 ? window : 1) * 1000;
+  }
+}
+break;
+
+case rotaryEncoderSnapshotCmd : { // concerns all encoders, so no unit
+  if (i == 2) { // 1 uint8_t mask, 1 uint8_t first record
+    uint8_t mask = 0; bufferIn->read(mask);
+    uint8_t first = 0; bufferIn->read(first);
+    if (first == 0) {
+      takeEncoderSnapshot(mask);
+    }
+    bufferOut->write(numEncoderRecords);
+    for (uint8_t r = first; r < first + encoderRecordsPerFrame; r++) {
+      writeEncoderRecord(r);
+    }
+  }
+}
+break;
+
 
 #endif // MF_STAGE_processMessage
 
@@ -164,11 +537,21 @@ break;
 #if MF_STAGE == MF_STAGE_reset
 
 for (uint8_t enc = 0; enc < numRotaryEncoders; enc++) {
+  if (encoders[enc].interruptDriven) {
+    detachInterrupt(digitalPinToInterrupt(encoders[enc].pin1));
+    detachInterrupt(digitalPinToInterrupt(encoders[enc].pin2));
+    encoders[enc].interruptDriven = false;
+  }
   delete encoders[enc].encoder;
+  delete encoders[enc].watch;
+  encoders[enc].watch = nullptr;
+  delete encoders[enc].velocity;
+  encoders[enc].velocity = nullptr;
   pinMode(encoders[enc].pin1, INPUT);
   pinMode(encoders[enc].pin2, INPUT);
 }
 numRotaryEncoders = 0;
+numEncoderRecords = 0;
 diagnosticsMode = false;
 
 #endif // MF_STAGE_reset
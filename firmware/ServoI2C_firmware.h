@@ -23,7 +23,11 @@
 
 #if MF_STAGE == MF_STAGE_includes
 
-#if defined(ARDUINO_ARCH_ESP32)
+// #define SERVOI2C_LEDC // uncomment to drive servos with the ESP32's LEDC hardware PWM instead of ESP32Servo
+
+#if defined(ARDUINO_ARCH_ESP32) && defined(SERVOI2C_LEDC)
+#include <soc/soc_caps.h> // LEDC timer width, see LedcServo below
+#elif defined(ARDUINO_ARCH_ESP32)
 #include <ESP32Servo.h> // ESP32 doesn't come with a native Servo.h
 #else
 #include <Servo.h>
@@ -37,13 +41,354 @@
 */
 
 #if MF_STAGE == MF_STAGE_declarations
-const uint8_t maxServos = 4;
-Servo servos[maxServos]; // @todo this should be an array of pointers to Servo objects
-uint8_t numServos = 0; // number of initialised servos.
+
+#if defined(ARDUINO_ARCH_ESP32) && defined(SERVOI2C_LEDC)
+
+#if !defined(MIN_PULSE_WIDTH)
+#define MIN_PULSE_WIDTH 544 // same defaults as Servo.h
+#define MAX_PULSE_WIDTH 2400
+#define DEFAULT_PULSE_WIDTH 1500
+#endif
+
+/*
+   Minimal replacement for the parts of the Servo interface used here. Each
+   servo gets its own LEDC channel, so the pulses are generated by hardware
+   without any timer ISR, and with a resolution of about 0.3 µs (16 bit) or
+   1.2 µs (14 bit on ESP32 variants with narrower LEDC timers).
+*/
+#if defined(SOC_LEDC_TIMER_BIT_WIDE_NUM) && (SOC_LEDC_TIMER_BIT_WIDE_NUM < 16)
+const uint8_t ledcServoBits = 14;
+#else
+const uint8_t ledcServoBits = 16;
+#endif
+const uint32_t ledcServoFrequency = 50; // Hz, i.e. 20000 µs period
+
+class LedcServo
+{
+public:
+  LedcServo(uint8_t channel) : channel(channel) {}
+
+  uint8_t attach(int pin, int min = MIN_PULSE_WIDTH, int max = MAX_PULSE_WIDTH)
+  {
+#if ESP_ARDUINO_VERSION_MAJOR >= 3
+    attachedPin = ledcAttachChannel(pin, ledcServoFrequency, ledcServoBits, channel) ? pin : -1;
+#else
+    if (ledcSetup(channel, ledcServoFrequency, ledcServoBits) > 0) {
+      ledcAttachPin(pin, channel);
+      attachedPin = pin;
+    }
+#endif
+    minPulse = min;
+    maxPulse = max;
+    writeMicroseconds(pulse);
+    return channel;
+  }
+
+  void detach()
+  {
+    if (attached()) {
+#if ESP_ARDUINO_VERSION_MAJOR >= 3
+      ledcDetach(attachedPin);
+#else
+      ledcDetachPin(attachedPin);
+#endif
+      attachedPin = -1;
+    }
+  }
+
+  void write(int value)
+  {
+    if (value < MIN_PULSE_WIDTH) {
+      value = map(value < 0 ? 0 : (value > 180 ? 180 : value), 0, 180, minPulse, maxPulse);
+    }
+    writeMicroseconds(value);
+  }
+
+  void writeMicroseconds(int value)
+  {
+    pulse = value < minPulse ? minPulse : (value > maxPulse ? maxPulse : value);
+    if (attached()) {
+      uint32_t duty = (uint32_t(pulse) << ledcServoBits) / (1000000UL / ledcServoFrequency);
+#if ESP_ARDUINO_VERSION_MAJOR >= 3
+      ledcWrite(attachedPin, duty);
+#else
+      ledcWrite(channel, duty);
+#endif
+    }
+  }
+
+  int read()
+  {
+    return map(pulse, minPulse, maxPulse, 0, 180);
+  }
+
+  int readMicroseconds()
+  {
+    return pulse;
+  }
+
+  bool attached()
+  {
+    return attachedPin >= 0;
+  }
+
+private:
+  uint8_t channel;
+  int attachedPin = -1;
+  int minPulse = MIN_PULSE_WIDTH;
+  int maxPulse = MAX_PULSE_WIDTH;
+  int pulse = DEFAULT_PULSE_WIDTH;
+};
+typedef LedcServo ServoType;
+
+#else
+
+typedef Servo ServoType;
+
+#endif // ARDUINO_ARCH_ESP32 && SERVOI2C_LEDC
+
+#if defined(ARDUINO_AVR_ATTINYX5) // ### include all other tinys
+const uint8_t maxServos = 2; // limited memory and pins
+#elif defined(ARDUINO_ARCH_AVR)
+const uint8_t maxServos = 12; // what the Servo library can drive with one timer
+#else
+const uint8_t maxServos = 16;
+#endif
+/*
+   Servo objects are allocated with the first attach to their slot and kept
+   after detach, as the AVR Servo library never gives back the timer channel
+   a Servo object took in its constructor.
+*/
+ServoType* servos[maxServos];
+bool servoSlotUsed[maxServos]; // false = free for the next attach
+
+/*
+   Pulse limits given to attach(), needed to convert angles, and the move in
+   progress, if any
+*/
+struct ServoMotion
+{
+  int16_t minPulse;
+  int16_t maxPulse;
+  bool moving = false;
+  bool interruptsEnabled = false; // for interruptReason_servoMoveDone
+  uint8_t easing;
+  int16_t from; // microseconds
+  int16_t to;
+  uint32_t start; // millis()
+  uint16_t duration; // ms
+};
+ServoMotion servoMotions[maxServos];
 
 bool validServo(int8_t s)
 {
-  return (s >= 0) and (s < numServos);
+  return (s >= 0) and (s < maxServos) and servoSlotUsed[s];
+}
+
+/*
+   Attach a new servo to the first free slot.
+   Returns the slot, or -1 if there is none or the servo could not be attached.
+*/
+int8_t addServo(int16_t pin, int16_t minPulse, int16_t maxPulse)
+{
+  int8_t s = 0;
+  while ((s < maxServos) and servoSlotUsed[s]) {
+    s++;
+  }
+  if (s == maxServos) {
+    return -1;
+  }
+  if (servos[s] == nullptr) {
+#if defined(ARDUINO_ARCH_ESP32) && defined(SERVOI2C_LEDC)
+    servos[s] = new ServoType(s); // slot = LEDC channel
+#else
+    servos[s] = new ServoType;
+#endif
+  }
+  servos[s]->attach(pin, minPulse, maxPulse);
+  if (not servos[s]->attached()) {
+    return -1;
+  }
+  servoSlotUsed[s] = true;
+  servoMotions[s].minPulse = minPulse;
+  servoMotions[s].maxPulse = maxPulse;
+  servoMotions[s].moving = false;
+  servoMotions[s].interruptsEnabled = false;
+  return s;
+}
+
+void removeServo(uint8_t s)
+{
+  servoMotions[s].moving = false;
+  servos[s]->detach();
+  servoSlotUsed[s] = false;
+}
+
+/*
+   Same interpretation as Servo::write(): small values are angles, large
+   ones pulse widths
+*/
+int16_t servoPulse(uint8_t s, int16_t value)
+{
+  if (value < MIN_PULSE_WIDTH) {
+    value = map(value < 0 ? 0 : (value > 180 ? 180 : value), 0, 180, servoMotions[s].minPulse, servoMotions[s].maxPulse);
+  }
+  return value;
+}
+
+void startServoMove(uint8_t s, int16_t value, uint16_t duration, uint8_t easing)
+{
+  ServoMotion* m = &servoMotions[s];
+  m->from = servos[s]->readMicroseconds();
+  m->to = servoPulse(s, value);
+  m->easing = easing;
+  m->start = millis();
+  m->duration = duration;
+  m->moving = true;
+}
+
+/*
+   Easing curves, map t = 0..1 to 0..1
+*/
+float ease(uint8_t easing, float t)
+{
+  switch (easing) {
+    case servoEaseIn:
+      return t * t;
+    case servoEaseOut:
+      return t * (2.0 - t);
+    case servoEaseInOut:
+      return t * t * (3.0 - 2.0 * t);
+    default: // servoEaseLinear
+      return t;
+  }
+}
+
+void runServoMove(uint8_t s)
+{
+  ServoMotion* m = &servoMotions[s];
+  uint32_t elapsed = millis() - m->start;
+  int16_t pulse = m->to;
+  if (elapsed < m->duration) {
+    pulse = m->from + int16_t(lround((m->to - m->from) * ease(m->easing, float(elapsed) / m->duration)));
+  } else {
+    m->moving = false;
+    if (m->interruptsEnabled) {
+      triggerInterrupt(s, interruptReason_servoMoveDone);
+    }
+  }
+  if (pulse != servos[s]->readMicroseconds()) {
+    servos[s]->writeMicroseconds(pulse);
+  }
+}
+
+/*
+   Keyframe animation, table allocated with the first servoClearAnimationCmd.
+   The positions of keyframe k are at keyframePositions[k * numAnimationServos].
+*/
+
+#if defined(ARDUINO_ARCH_AVR)
+const uint8_t maxKeyframes = 16;
+#else
+const uint8_t maxKeyframes = 64;
+#endif
+
+struct Keyframe
+{
+  uint16_t time; // ms from the start of the animation
+  uint8_t easing; // of the moves from the previous keyframe to this one
+};
+Keyframe* keyframes = nullptr;
+int16_t* keyframePositions = nullptr;
+uint8_t numKeyframes = 0;
+uint8_t animationServos[maxAnimationServos];
+uint8_t numAnimationServos = 0;
+int16_t animationStartPositions[maxAnimationServos]; // where the servos were when the animation started
+bool animationPlaying = false;
+bool animationLoop;
+bool animationInterruptsEnabled = false; // for interruptReason_servoAnimationDone
+bool animationFirstCycle;
+uint32_t animationStart; // millis() at the start of the current cycle
+
+void clearAnimation(uint16_t mask)
+{
+  if (keyframes == nullptr) {
+    keyframes = new Keyframe[maxKeyframes];
+    keyframePositions = new int16_t[maxKeyframes * maxAnimationServos];
+  }
+  animationPlaying = false;
+  numKeyframes = numAnimationServos = 0;
+  for (uint8_t s = 0; (s < 16) and (numAnimationServos < maxAnimationServos); s++) {
+    if ((mask & (1u << s)) and validServo(s)) {
+      animationServos[numAnimationServos++] = s;
+    }
+  }
+}
+
+void playAnimation(bool loop)
+{
+  if (numKeyframes == 0) {
+    return;
+  }
+  for (uint8_t a = 0; a < numAnimationServos; a++) {
+    uint8_t s = animationServos[a];
+    servoMotions[s].moving = false;
+    animationStartPositions[a] = servos[s]->readMicroseconds();
+  }
+  animationLoop = loop and (keyframes[numKeyframes - 1].time > 0); // else it would never advance
+  animationFirstCycle = true;
+  animationStart = millis();
+  animationPlaying = true;
+}
+
+/*
+   Interpolate between the keyframes around the current time. In the first
+   cycle, the moves to the first keyframe start from where the servos were,
+   in later ones from the last keyframe.
+*/
+void runAnimation()
+{
+  uint16_t duration = keyframes[numKeyframes - 1].time;
+  uint32_t elapsed = millis() - animationStart;
+  if (elapsed >= duration) {
+    if (animationLoop) {
+      animationStart += duration * (elapsed / duration);
+      elapsed %= duration;
+      animationFirstCycle = false;
+    } else {
+      elapsed = duration;
+      animationPlaying = false;
+      if (animationInterruptsEnabled) {
+        triggerInterrupt(0, interruptReason_servoAnimationDone);
+      }
+    }
+  }
+  uint8_t k = 0;
+  while ((k < numKeyframes - 1) and (keyframes[k].time <= elapsed)) {
+    k++;
+  }
+  int16_t* to = &keyframePositions[k * numAnimationServos];
+  int16_t* from;
+  uint16_t fromTime = 0;
+  if (k > 0) {
+    from = &keyframePositions[(k - 1) * numAnimationServos];
+    fromTime = keyframes[k - 1].time;
+  } else if (animationFirstCycle) {
+    from = animationStartPositions;
+  } else {
+    from = &keyframePositions[(numKeyframes - 1) * numAnimationServos];
+  }
+  float t = 1.0;
+  if (keyframes[k].time > fromTime) {
+    t = ease(keyframes[k].easing, float(elapsed - fromTime) / (keyframes[k].time - fromTime));
+  }
+  for (uint8_t a = 0; a < numAnimationServos; a++) {
+    int16_t pulse = from[a] + int16_t(lround((to[a] - from[a]) * t));
+    uint8_t s = animationServos[a];
+    if (pulse != servos[s]->readMicroseconds()) {
+      servos[s]->writeMicroseconds(pulse);
+    }
+  }
 }
 #endif // MF_STAGE_declarations
 
@@ -62,6 +407,14 @@ log("ServoI2C module enabled.\n");
 */
 
 #if MF_STAGE == MF_STAGE_loop
+for (uint8_t s = 0; s < maxServos; s++) {
+  if (servoMotions[s].moving) {
+    runServoMove(s);
+  }
+}
+if (animationPlaying) {
+  runAnimation();
+}
 #endif // MF_STAGE_loop
 
 
@@ -78,29 +431,28 @@ log("ServoI2C module enabled.\n");
 */
 
 case servoAttach1Cmd: {
-  if ((numServos < maxServos) and (i == 2)) { // 1 int
+  if (i == 2) { // 1 int
     int16_t p; bufferIn->read(p);
-    servos[numServos].attach(p);
-    bufferOut->write(numServos++);
-    log(numServos);
+    int8_t s = addServo(p, MIN_PULSE_WIDTH, MAX_PULSE_WIDTH);
+    bufferOut->write(s);
+    log(s);
   }
 }
 break;
 
 case servoAttach2Cmd: {
-  if ((numServos < maxServos) and (i == 6)) { // 3 int
+  if (i == 6) { // 3 int
     int16_t  p; bufferIn->read(p);
     int16_t  min; bufferIn->read(min);
     int16_t  max; bufferIn->read(max);
-    servos[numServos].attach(p, min, max);
-    bufferOut->write(numServos++);
+    bufferOut->write(addServo(p, min, max));
   }
 }
 break;
 
 case servoDetachCmd: {
   if (validServo(unit) and (i == 0)) { // no parameters
-    servos[unit].detach();
+    removeServo(unit); // frees the slot for the next attach
   }
 }
 break;
@@ -108,7 +460,8 @@ break;
 case servoWriteCmd: {
   if (validServo(unit) and (i == 2)) { // 1 int
     int16_t  value; bufferIn->read(value);
-    servos[unit].write(value);
+    servoMotions[unit].moving = false;
+    servos[unit]->write(value);
   }
 }
 break;
@@ -116,28 +469,129 @@ break;
 case servoWriteMicrosecondsCmd: {
   if (validServo(unit) and (i == 2)) { // 1 int
     int16_t value; bufferIn->read(value);
-    servos[unit].writeMicroseconds(value);
+    servoMotions[unit].moving = false;
+    servos[unit]->writeMicroseconds(value);
   }
 }
 break;
 
 case servoReadCmd: {
   if (validServo(unit) and (i == 0)) { // no parameters
-    bufferOut->write((int16_t)servos[unit].read());
+    bufferOut->write((int16_t)servos[unit]->read());
   }
 }
 break;
 
 case servoReadMicrosecondsCmd: {
   if (validServo(unit) and (i == 0)) { // no parameters
-    bufferOut->write((int16_t)servos[unit].readMicroseconds());
+    bufferOut->write((int16_t)servos[unit]->readMicroseconds());
   }
 }
 break;
 
 case servoAttachedCmd: {
+  if (i == 0) { // no parameters
+    bufferOut->write(uint8_t(validServo(unit) and servos[unit]->attached())); // detached servos have no slot anymore
+  }
+}
+break;
+
+case servoMoveCmd: {
+  if (validServo(unit) and (i == 5)) { // 1 int, 1 uint16_t, 1 uint8_t
+    int16_t value; bufferIn->read(value);
+    uint16_t duration = 0; bufferIn->read(duration);
+    uint8_t easing = servoEaseLinear; bufferIn->read(easing);
+    startServoMove(unit, value, duration, easing);
+  }
+}
+break;
+
+case servoWriteGroupCmd: { // concerns several servos, so no unit
+  if ((i >= 2) and (i % 2 == 0)) { // 1 uint16_t mask, 1 int for each servo in mask
+    uint16_t mask = 0; bufferIn->read(mask);
+    uint8_t numValues = (i - 2) / 2;
+    for (uint8_t s = 0; (s < 16) and (numValues > 0); s++) { // all in this loop() iteration
+      if (mask & (1u << s)) {
+        int16_t value; bufferIn->read(value);
+        numValues--;
+        if (validServo(s)) {
+          servoMotions[s].moving = false;
+          servos[s]->writeMicroseconds(servoPulse(s, value));
+        }
+      }
+    }
+  }
+}
+break;
+
+case servoClearAnimationCmd: { // one animation per target, so no unit
+  if (i == 2) { // 1 uint16_t
+    uint16_t mask = 0; bufferIn->read(mask);
+    clearAnimation(mask);
+  }
+}
+break;
+
+case servoAddKeyframeCmd: {
+  if (i >= 3) { // 1 uint16_t, 1 uint8_t, 1 int for each servo in the animation
+    uint16_t time = 0; bufferIn->read(time);
+    uint8_t easing = servoEaseLinear; bufferIn->read(easing);
+    int8_t res = -1;
+    if ((keyframes != nullptr) and (not animationPlaying) and (numKeyframes < maxKeyframes)
+        and (i == 3 + 2 * numAnimationServos)
+        and ((numKeyframes == 0) or (time > keyframes[numKeyframes - 1].time))) {
+      keyframes[numKeyframes].time = time;
+      keyframes[numKeyframes].easing = easing;
+      for (uint8_t a = 0; a < numAnimationServos; a++) {
+        int16_t value; bufferIn->read(value);
+        keyframePositions[numKeyframes * numAnimationServos + a] = servoPulse(animationServos[a], value);
+      }
+      res = ++numKeyframes;
+    }
+    bufferOut->write(res);
+  }
+}
+break;
+
+case servoPlayAnimationCmd: {
+  if (i == 1) { // 1 bool
+    bool loop = false; bufferIn->read(loop);
+    playAnimation(loop);
+  }
+}
+break;
+
+case servoStopAnimationCmd: {
+  if (i == 0) { // no parameters
+    animationPlaying = false;
+  }
+}
+break;
+
+case servoEnableAnimationInterruptsCmd: {
+  if (i == 1) { // 1 bool
+    bufferIn->read(animationInterruptsEnabled);
+  }
+}
+break;
+
+case servoAnimationPlayingCmd: {
+  if (i == 0) { // no parameters
+    bufferOut->write(uint8_t(animationPlaying));
+  }
+}
+break;
+
+case servoEnableInterruptsCmd: {
+  if (validServo(unit) and (i == 1)) { // 1 bool
+    bufferIn->read(servoMotions[unit].interruptsEnabled);
+  }
+}
+break;
+
+case servoMovingCmd: {
   if (validServo(unit) and (i == 0)) { // no parameters
-    bufferOut->write(uint8_t(servos[unit].attached()));
+    bufferOut->write(uint8_t(servoMotions[unit].moving));
   }
 }
 break;
@@ -151,9 +605,17 @@ break;
 
 #if MF_STAGE == MF_STAGE_reset
 
-for (uint8_t i = 0; i < numServos; i++) {
-  servos[i].detach();
+for (uint8_t i = 0; i < maxServos; i++) {
+  if (servoSlotUsed[i]) {
+    removeServo(i);
+  }
 }
-numServos = 0;
+animationPlaying = false;
+animationInterruptsEnabled = false;
+delete[] keyframes;
+keyframes = nullptr;
+delete[] keyframePositions;
+keyframePositions = nullptr;
+numKeyframes = numAnimationServos = 0;
 
 #endif // MF_STAGE_reset
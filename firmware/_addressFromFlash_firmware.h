@@ -104,7 +104,13 @@ void storeI2C_address(uint8_t newAddress)
     log(b.buffer[i]); log (" ");
   }
 #if defined(ARDUINO_ARCH_ESP32) || defined(ARDUINO_ARCH_ESP8266)
+#if defined(ROTARYENCODERI2C_INTERRUPTS)
+  suspendEncoderISRs(true); // they call library code in flash, which is unavailable while writing to it
+#endif // ROTARYENCODERI2C_INTERRUPTS
   EEPROM.end(); // end() will also commit()
+#if defined(ROTARYENCODERI2C_INTERRUPTS)
+  suspendEncoderISRs(false);
+#endif // ROTARYENCODERI2C_INTERRUPTS
 #endif // defined(ARDUINO_ARCH_ESP32) || defined(ARDUINO_ARCH_ESP8266)
   log("\n");
 #else // USE_EEPROM
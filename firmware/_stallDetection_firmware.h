@@ -0,0 +1,205 @@
+/*!
+   @file _stallDetection_firmware.h
+   @brief Feature module.
+   Links a RotaryEncoderI2C encoder to an AccelStepperI2C stepper on the same
+   target, so that lost steps can be detected without any bus traffic: In
+   each loop() cycle, the stepper's position (i.e. the steps it was told to
+   do) is compared to the position measured by the encoder. If the
+   difference (following error) exceeds a set limit, the stepper is stopped
+   and/or an interrupt is sent to the controller.
+   Needs both AccelStepperI2C_firmware.h and RotaryEncoderI2C_firmware.h to be
+   enabled in firmware_modules.h.
+   ## Author
+   Copyright (c) 2023 juh
+   ## License
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation, version 2.
+*/
+
+/// @cond
+
+/*
+   (1) includes
+*/
+
+#if MF_STAGE == MF_STAGE_includes
+#define STALL_DETECTION_ENABLED // makes AccelStepperI2C_firmware.h tell us about position changes
+#endif // MF_STAGE_includes
+
+
+/*
+   (2) declarations
+*/
+
+#if MF_STAGE == MF_STAGE_declarations
+
+#if !defined(AccelStepperI2C_h) || !defined(RotaryEncoderI2C_h)
+#error _stallDetection_firmware.h needs the AccelStepperI2C and RotaryEncoderI2C modules.
+#endif
+
+struct StallBinding
+{
+  int8_t encoder = -1; // -1 = not bound
+  float stepsPerCount; // negative if encoder counts opposite to the stepper
+  long maxError;
+  bool stop; // stop stepper on stall (else only interrupt)
+  bool stalled; // prevents repeated interrupts until the binding is renewed
+  long stepperReference; // stepper's and encoder's positions when the binding was made
+  long encoderReference;
+};
+StallBinding* stallBindings[maxSteppers]; // allocated on demand, nullptr = not bound
+uint8_t numStallBindings = 0; // bound steppers, the loop has nothing to do without any
+
+/*
+   Difference between the stepper's commanded and measured position in steps.
+*/
+long followingError(uint8_t s)
+{
+  StallBinding* b = stallBindings[s];
+  long commanded = steppers[s].stepper->currentPosition() - b->stepperReference;
+  long measured = lround((encoderPosition(b->encoder) - b->encoderReference) * b->stepsPerCount);
+  return commanded - measured;
+}
+
+/*
+   Called by AccelStepperI2C_firmware.h when the stepper's position is set,
+   e.g. after homing, so that the jump doesn't look like lost steps.
+*/
+void rebaseStallDetection(uint8_t s)
+{
+  StallBinding* b = stallBindings[s];
+  if ((b != nullptr) and (b->encoder >= 0)) {
+    b->stepperReference = steppers[s].stepper->currentPosition();
+    b->encoderReference = encoderPosition(b->encoder);
+  }
+}
+
+void checkStall(uint8_t s)
+{
+  StallBinding* b = stallBindings[s];
+  if (b->stalled or (labs(followingError(s)) <= b->maxError)) {
+    return;
+  }
+  log("   Stall detected!\n");
+  b->stalled = true;
+  if (b->stop) { // same as an endstop hit
+    stopStepper(s);
+  }
+  triggerStepperInterrupt(s, interruptReason_stallDetected);
+}
+
+#endif // MF_STAGE_declarations
+
+
+/*
+   (3) setup() function
+*/
+
+#if MF_STAGE == MF_STAGE_setup
+log("stallDetection feature enabled.\n");
+#endif // MF_STAGE_setup
+
+
+/*
+   (4) main loop() function
+*/
+
+#if MF_STAGE == MF_STAGE_loop
+if (numStallBindings > 0) { // don't contend for the mutex needlessly
+#if defined(ACCELSTEPPERI2C_DUAL_CORE)
+  lockStepperMutex(); // the state machine runs on the other core
+#endif // ACCELSTEPPERI2C_DUAL_CORE
+  for (uint8_t s = 0; s < numSteppers; s++) {
+    if ((stallBindings[s] != nullptr) and (stallBindings[s]->encoder >= 0)) {
+      checkStall(s);
+    }
+  }
+#if defined(ACCELSTEPPERI2C_DUAL_CORE)
+  unlockStepperMutex();
+#endif // ACCELSTEPPERI2C_DUAL_CORE
+}
+#endif // MF_STAGE_loop
+
+
+/*
+   (5) processMessage() function
+*/
+
+#if MF_STAGE == MF_STAGE_processMessage
+
+case stallDetectionCmd: {
+  if (validStepper(unit) and (i == 10)) { // 1 int8_t, 1 float, 1 int32_t, 1 bool
+    int8_t encoder = -1; bufferIn->read(encoder);
+    float stepsPerCount = 1.0; bufferIn->read(stepsPerCount);
+    int32_t maxError = 0; bufferIn->read(maxError);
+    bool stop = true; bufferIn->read(stop);
+    if (stallBindings[unit] == nullptr) {
+      stallBindings[unit] = new StallBinding;
+    }
+    StallBinding* b = stallBindings[unit];
+    if (b->encoder >= 0) {
+      numStallBindings--;
+    }
+    b->encoder = validEncoder(encoder) ? encoder : -1;
+    if (b->encoder >= 0) {
+      numStallBindings++;
+      b->stepsPerCount = stepsPerCount;
+      b->maxError = labs(maxError);
+      b->stop = stop;
+      b->stalled = false;
+      b->stepperReference = steppers[unit].stepper->currentPosition();
+      b->encoderReference = encoderPosition(encoder);
+    }
+  }
+}
+break;
+
+case followingErrorCmd: {
+  if (validStepper(unit) and (i == 0)) { // no parameters
+    bufferOut->write((int32_t)((stallBindings[unit] != nullptr) and (stallBindings[unit]->encoder >= 0) ? followingError(unit) : 0));
+  }
+}
+break;
+
+#endif // MF_STAGE_processMessage
+
+
+/*
+   (6) reset event
+*/
+
+#if MF_STAGE == MF_STAGE_reset
+for (uint8_t s = 0; s < maxSteppers; s++) {
+  delete stallBindings[s]; // deleting nullptr is safe
+  stallBindings[s] = nullptr;
+}
+numStallBindings = 0;
+#endif // MF_STAGE_reset
+
+
+/*
+   (7) (end of) receiveEvent()
+*/
+
+#if MF_STAGE == MF_STAGE_receiveEvent
+#endif // MF_STAGE_receiveEvent
+
+
+/*
+   (8) (end of) requestEvent()
+*/
+
+#if MF_STAGE == MF_STAGE_requestEvent
+#endif // MF_STAGE_requestEvent
+
+
+/*
+   (9) Change of I2C state machine's state
+*/
+
+#if MF_STAGE == MF_STAGE_I2CstateChange
+#endif // MF_STAGE_I2CstateChange
+
+
+/// @endcond
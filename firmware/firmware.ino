@@ -16,6 +16,7 @@
 */
 
 //#define DEBUG // Uncomment this to enable library debugging output on Serial
+//#define I2C_MESSAGE_QUEUE // ESP32 only: uncomment to process messages in their own task, fed by a queue
 
 #include <Arduino.h>
 #include <Wire.h>
@@ -97,6 +98,7 @@ const uint32_t reportPeriod = 2000; // ms between main loop simple diagnostics o
 // #endif // DIAGNOSTICS
 
 uint32_t cycles = 0; // keeps count of main loop iterations
+uint32_t messagesProcessed = 0; // keeps count of processMessage() calls, modules may use it for statistics
 
 
 /*
@@ -155,6 +157,35 @@ void changeI2CstateTo(I2Cstates newState) {
 }
 
 
+/*
+   Message queue stuff (ESP32 only). receiveEvent() just copies each message
+   into a FreeRTOS queue. A task with higher priority than Arduino's loop()
+   task takes them out one by one and processes them. As it has bufferIn and
+   bufferOut to itself, the ISRs cannot mess with a message or reply while it
+   is being processed. A mutex makes sure that processMessage() and the
+   modules' loop() sections never run at the same time.
+*/
+
+#if defined(I2C_MESSAGE_QUEUE)
+
+#if !defined(ARDUINO_ARCH_ESP32)
+#error I2C_MESSAGE_QUEUE needs an ESP32 target (the ESP8266 Arduino core has no FreeRTOS).
+#endif
+
+struct I2Cmessage
+{
+  uint8_t len;
+  uint8_t data[I2CmaxBuf];
+};
+const uint8_t messageQueueLength = 4; // messages received while an earlier one is being processed
+const UBaseType_t messageTaskPriority = 2; // higher than Arduino's loop() task, so that it is preempted as soon as a message is waiting
+QueueHandle_t messageQueue;
+SemaphoreHandle_t modulesMutex;
+void messageTask(void* parameter);
+
+#endif // I2C_MESSAGE_QUEUE
+
+
 // Forward declarations. Without them, the Arduino magic will be confused by the IRAM_ATTR stuff.
 // Not sure if the IRAM stuff needs to happen here already, but I guess it won't harm.
 #if defined(ARDUINO_ARCH_ESP32) || defined(ARDUINO_ARCH_ESP8266) // both platforms now use "IRAM_ATTR"
@@ -244,6 +275,16 @@ void initializeFirmware()
 #undef MF_STAGE
 
 
+// Modules can claim a lock that is held while a message is processed, e.g. to
+// protect data they share with a task running on another core (see
+// AccelStepperI2C_firmware.h). Must be placed here after the
+// MF_STAGE_declarations module injection.
+#ifndef PROCESS_MESSAGE_LOCK_DEFINED_BY_MODULE
+#define processMessageLock(cmd)
+#define processMessageUnlock(cmd)
+#endif
+
+
 // Join I2C bus as target and start the necessary ISRs.
 // This is outsourced to a function, as it is needed by setup() and reset code.
 // Must be placed here after the MF_STAGE_declarations module injection, so that
@@ -315,6 +356,13 @@ void setup()
   bufferIn = new SimpleBuffer; bufferIn->init(I2CmaxBuf);
   bufferOut = new SimpleBuffer; bufferOut->init(I2CmaxBuf);
 
+#if defined(I2C_MESSAGE_QUEUE)
+  messageQueue = xQueueCreate(messageQueueLength, sizeof(I2Cmessage));
+  modulesMutex = xSemaphoreCreateMutex();
+  xTaskCreatePinnedToCore(messageTask, "I2Cmessages", 4096, nullptr, messageTaskPriority, nullptr, xPortGetCoreID());
+  log("Processing messages in their own task.\n");
+#endif // I2C_MESSAGE_QUEUE
+
   startI2C();
 
   initializeFirmware();
@@ -347,6 +395,10 @@ void loop()
   }
 #endif // defined(DEBUG)
 
+#if defined(I2C_MESSAGE_QUEUE)
+  xSemaphoreTake(modulesMutex, portMAX_DELAY);
+#endif // I2C_MESSAGE_QUEUE
+
   /*
     Inject modules' loop section
   */
@@ -354,6 +406,10 @@ void loop()
 #include "firmware_modules.h"
 #undef MF_STAGE
 
+#if defined(I2C_MESSAGE_QUEUE)
+  xSemaphoreGive(modulesMutex); // the message task is waiting for it and will take over right here
+#endif // I2C_MESSAGE_QUEUE
+
 #if defined(DEBUG)
   if (reportNow) {
     log("\n");
@@ -363,9 +419,11 @@ void loop()
 
   // Check for new incoming messages from I2C interrupt
   //if (newMessage > 0) {
+#if !defined(I2C_MESSAGE_QUEUE) // otherwise the message task takes care of them
   if (I2Cstate == processingCommand) {
     processMessage(newMessage);
   }
+#endif // I2C_MESSAGE_QUEUE
 
 
 
@@ -410,6 +468,7 @@ void processMessage(uint8_t len)
 //   uint32_t thenMicrosP = micros();
 // #endif // DIAGNOSTICS
 
+  messagesProcessed++;
   log("New message with "); log(len); log(" bytes. ");
   for (int j = 0; j < len; j++)  { // I expect the compiler will optimize this away if debugging is off
     log (bufferIn->buffer[j]); log(" ");
@@ -426,6 +485,7 @@ void processMessage(uint8_t len)
     log(" with "); log(i); log(" parameter bytes --> ");
     bufferOut->reset();  // let's hope last result was already requested by controller, as now it's gone
 
+    processMessageLock(cmd);
     switch (cmd) {
 
         /*
@@ -515,6 +575,7 @@ void processMessage(uint8_t len)
         log("No matching command found");
 
     } // switch
+    processMessageUnlock(cmd);
 
 #if defined(DEBUG)
     if (bufferOut->idx > 1) {
@@ -563,6 +624,37 @@ void processMessage(uint8_t len)
 }
 
 
+// ================================================================================
+// ============================ messageTask() =====================================
+// ================================================================================
+
+#if defined(I2C_MESSAGE_QUEUE)
+
+/**************************************************************************/
+/*!
+  @brief Task that processes the messages queued by receiveEvent(), if
+  I2C_MESSAGE_QUEUE is defined. Replaces the polling in loop().
+*/
+/**************************************************************************/
+void messageTask(void* parameter)
+{
+  I2Cmessage message;
+  while (true) {
+    if (xQueueReceive(messageQueue, &message, portMAX_DELAY) == pdTRUE) {
+      xSemaphoreTake(modulesMutex, portMAX_DELAY);
+      bufferIn->reset();
+      memcpy(bufferIn->buffer, message.data, message.len);
+      bufferIn->idx = message.len;
+      changeI2CstateTo(processingCommand);
+      processMessage(message.len); // will also prefill the ESP32's reply buffer
+      xSemaphoreGive(modulesMutex);
+    }
+  }
+}
+
+#endif // I2C_MESSAGE_QUEUE
+
+
 // ================================================================================
 // ============================ receiveEvent() ====================================
 // ================================================================================
@@ -592,6 +684,21 @@ void receiveEvent(int howMany)
 #include "firmware_modules.h"
 #undef MF_STAGE
 
+#if defined(I2C_MESSAGE_QUEUE)
+  I2Cmessage message;
+  message.len = min(howMany, (int)I2CmaxBuf);
+  for (uint8_t i = 0; i < howMany; i++) {
+    uint8_t b = Wire.read();
+    if (i < message.len) {
+      message.data[i] = b;
+    }
+  }
+  if (I2Cstate != initializing) {
+    xQueueSend(messageQueue, &message, 0); // don't wait, if the queue is full the message is lost
+  }
+  return;
+#endif // I2C_MESSAGE_QUEUE
+
   switch (I2Cstate) {
 
 
@@ -21,6 +21,8 @@
 //#include "PinI2C_firmware.h"            // should work on any platform, 
 //#include "ServoI2C_firmware.h"          // will not compile on Attinys
 //#include "TM1638liteI2C_firmware.h"     // should work on any platform
+//#include "RotaryEncoderI2C_firmware.h"  // should work on any platform
+//#include "GcodeI2C_firmware.h"          // needs AccelStepperI2C_firmware.h, include it after that
 #include "UcglibI2C_firmware.h"
 
 /*
@@ -28,6 +30,7 @@
 */
 
 #include "_statusLED_firmware.h"        // makes the LED_BUILTIN flash briefly on each received interrupt
+//#include "_stallDetection_firmware.h"   // compares stepper and encoder positions to detect lost steps, needs AccelStepperI2C and RotaryEncoderI2C
 
 // note: use *only one* of the following "_address..." modules at a time.
 // If all are deactivated, the default I2CwrapperDefaultAddress (0x8) will be used
@@ -227,6 +227,19 @@ void AccelStepperI2C::setPinsInverted(bool pin1Invert, bool pin2Invert, bool pin
 void AccelStepperI2C::runToPosition()
 {
   runState(); // start state machine with currently set target
+  if (wrapper->listensToInterrupts() and interruptsOn) { // no need to poll often
+    while (true) {
+      uint8_t reason = wrapper->waitFor(anyReason, myNum, 100);
+      if ((reason == interruptReason_targetReachedByRun) or (reason == interruptReason_endstopHit)) {
+        return;
+      }
+      // other reasons and timeouts: the stepper may have been stopped otherwise (e.g. by stall
+      // detection), or its interrupt may have been lost or overwritten by another one
+      if (getState() == state_stopped) {
+        return;
+      }
+    }
+  }
   while (isRunning()) {
     delay(100); // this is a bit arbitrary, but given usual motor applications, a precision of 1/10 second should be ok in most situations
   }
@@ -325,6 +338,142 @@ void AccelStepperI2C::runSpeedToPositionState()
 }
 
 
+void AccelStepperI2C::home(float fastSpeed, float slowSpeed, long backOff, long position)
+{
+  wrapper->prepareCommand(homeCmd, myNum);
+  wrapper->buf.write(fastSpeed);
+  wrapper->buf.write(slowSpeed);
+  wrapper->buf.write((int32_t)backOff);
+  wrapper->buf.write((int32_t)position);
+  wrapper->sendCommand();
+}
+
+
+void AccelStepperI2C::setJerk(float jerk)
+{
+  wrapper->prepareCommand(setJerkCmd, myNum);
+  wrapper->buf.write(jerk);
+  wrapper->sendCommand();
+}
+
+
+void AccelStepperI2C::jog(float speed)
+{
+  wrapper->prepareCommand(jogCmd, myNum);
+  wrapper->buf.write(speed);
+  wrapper->sendCommand();
+}
+
+
+void AccelStepperI2C::setJogTimeout(uint16_t timeout)
+{
+  wrapper->prepareCommand(setJogTimeoutCmd, myNum);
+  wrapper->buf.write(timeout);
+  wrapper->sendCommand();
+}
+
+
+void AccelStepperI2C::setStallDetection(int8_t encoder, float stepsPerCount, long maxError, bool stop)
+{
+  wrapper->prepareCommand(stallDetectionCmd, myNum);
+  wrapper->buf.write(encoder);
+  wrapper->buf.write(stepsPerCount);
+  wrapper->buf.write((int32_t)maxError);
+  wrapper->buf.write(stop);
+  wrapper->sendCommand();
+}
+
+
+long AccelStepperI2C::followingError()
+{
+  wrapper->prepareCommand(followingErrorCmd, myNum);
+  int32_t res = 0;
+  if (wrapper->sendCommand() and wrapper->readResult(followingErrorResult)) {
+    wrapper->buf.read(res);
+  }
+  return res;
+}
+
+
+int8_t AccelStepperI2C::addPositionTrigger(long position, int8_t pin, uint8_t pinAction, bool interrupt)
+{
+  wrapper->prepareCommand(addPositionTriggerCmd, myNum);
+  wrapper->buf.write((int32_t)position);
+  wrapper->buf.write(pin);
+  wrapper->buf.write(pinAction);
+  wrapper->buf.write(interrupt);
+  int8_t res = -1;
+  if (wrapper->sendCommand() and wrapper->readResult(addPositionTriggerResult)) {
+    wrapper->buf.read(res);
+  }
+  return res;
+}
+
+
+void AccelStepperI2C::clearPositionTriggers()
+{
+  wrapper->prepareCommand(clearPositionTriggersCmd, myNum);
+  wrapper->sendCommand();
+}
+
+
+uint8_t AccelStepperI2C::firedTriggers()
+{
+  wrapper->prepareCommand(firedTriggersCmd, myNum);
+  uint8_t res = 0;
+  if (wrapper->sendCommand() and wrapper->readResult(firedTriggersResult)) {
+    wrapper->buf.read(res);
+  }
+  return res;
+}
+
+
+void AccelStepperI2C::runQueueState()
+{
+  setState(state_runQueue);
+}
+
+
+int8_t AccelStepperI2C::queueMoveTo(long absolute, float speed, float acceleration)
+{
+  wrapper->prepareCommand(queueMoveToCmd, myNum);
+  wrapper->buf.write((int32_t)absolute);
+  wrapper->buf.write(speed);
+  wrapper->buf.write(acceleration);
+  int8_t res = -1;
+  if (wrapper->sendCommand() and wrapper->readResult(queueMoveToResult)) {
+    wrapper->buf.read(res);
+  }
+  return res;
+}
+
+
+int8_t AccelStepperI2C::queueFree()
+{
+  wrapper->prepareCommand(queueFreeCmd, myNum);
+  int8_t res = -1;
+  if (wrapper->sendCommand() and wrapper->readResult(queueFreeResult)) {
+    wrapper->buf.read(res);
+  }
+  return res;
+}
+
+
+void AccelStepperI2C::clearQueue()
+{
+  wrapper->prepareCommand(clearQueueCmd, myNum);
+  wrapper->sendCommand();
+}
+
+
+void AccelStepperI2C::setQueueLowWater(uint8_t level)
+{
+  wrapper->prepareCommand(setQueueLowWaterCmd, myNum);
+  wrapper->buf.write(level);
+  wrapper->sendCommand();
+}
+
+
 void AccelStepperI2C::setEndstopPin(int8_t pin,
                                     bool activeLow,
                                     bool internalPullup)
@@ -360,6 +509,251 @@ void AccelStepperI2C::enableInterrupts(bool enable)
 {
   wrapper->prepareCommand(enableInterruptsCmd, myNum);
   wrapper->buf.write(enable);
+  if (wrapper->sendCommand()) {
+    interruptsOn = enable;
+  }
+}
+
+
+bool AccelStepperI2C::onTargetReached(InterruptCallback callback)
+{
+  return wrapper->onInterrupt(callback, interruptReason_targetReachedByRun, myNum)
+         and wrapper->onInterrupt(callback, interruptReason_targetReachedByRunSpeedToPosition, myNum);
+}
+
+
+bool AccelStepperI2C::onEndstop(InterruptCallback callback)
+{
+  return wrapper->onInterrupt(callback, interruptReason_endstopHit, myNum);
+}
+
+
+// static, as it concerns all steppers of a target
+uint8_t AccelStepperI2C::statusSnapshot(I2Cwrapper* w, StepperStatus status[], uint8_t maxRecords, uint16_t mask)
+{
+  uint8_t numRecords = 0; // total number of records in the target's snapshot, known after the first transmission
+  uint8_t received = 0;
+  do {
+    w->prepareCommand(statusSnapshotCmd);
+    w->buf.write(mask);
+    w->buf.write(received); // first record to send, 0 makes the target take a new snapshot
+    if (not (w->sendCommand() and w->readResult(statusSnapshotResult))) {
+      return 0;
+    }
+    w->buf.read(numRecords);
+    for (uint8_t r = 0; (r < statusRecordsPerFrame) and (received < numRecords) and (received < maxRecords); r++) {
+      StepperStatus* st = &status[received++];
+      int32_t l = 0;
+      w->buf.read(st->stepper);
+      w->buf.read(st->state);
+      w->buf.read(st->endstops);
+      w->buf.read(l); st->currentPosition = l;
+      w->buf.read(l); st->distanceToGo = l;
+      w->buf.read(st->speed);
+    }
+  } while ((received < numRecords) and (received < maxRecords));
+  return received;
+}
+
+
+void AccelStepperI2C::startRecording(I2Cwrapper* w, uint32_t interval, uint16_t mask)
+{
+  w->prepareCommand(startRecordingCmd);
+  w->buf.write(interval);
+  w->buf.write(mask);
+  w->sendCommand();
+}
+
+
+void AccelStepperI2C::stopRecording(I2Cwrapper* w)
+{
+  w->prepareCommand(stopRecordingCmd);
+  w->sendCommand();
+}
+
+
+uint16_t AccelStepperI2C::fetchRecording(I2Cwrapper* w, MotionSample samples[], uint16_t maxSamples)
+{
+  uint16_t numSamples = 0; // total number of samples on the target, known after the first transmission
+  uint16_t received = 0;
+  do {
+    w->prepareCommand(motionSamplesCmd);
+    w->buf.write(received); // first sample to send, 0 makes the target stop recording
+    if (not (w->sendCommand() and w->readResult(motionSamplesResult))) {
+      return 0;
+    }
+    w->buf.read(numSamples);
+    uint16_t frameStart = received;
+    while ((received < numSamples) and (received < maxSamples)) {
+      uint8_t header = 0; // stays 0 if we've read past the reply's end
+      w->buf.read(header);
+      MotionSample* m = &samples[received];
+      m->stepper = header & ~(motionSampleCompact | motionSampleFull);
+      if (header & motionSampleFull) {
+        int32_t l = 0;
+        w->buf.read(m->time);
+        w->buf.read(l); m->position = l;
+        w->buf.read(m->speed);
+      } else if ((header & motionSampleCompact) and (received > 0)) { // decode against the samples we already have
+        uint16_t dt = 0; w->buf.read(dt);
+        int16_t dp = 0; w->buf.read(dp);
+        int16_t speed = 0; w->buf.read(speed);
+        m->time = samples[received - 1].time + dt;
+        m->position = dp;
+        for (uint16_t p = received; (p > 0) and (received - p < motionSampleSearchDepth); p--) {
+          if (samples[p - 1].stepper == m->stepper) {
+            m->position += samples[p - 1].position;
+            break;
+          }
+        }
+        m->speed = speed;
+      } else { // rest of the reply is unused
+        break;
+      }
+      received++;
+    }
+    if (received == frameStart) { // target sent nothing, don't ask forever
+      break;
+    }
+  } while ((received < numSamples) and (received < maxSamples));
+  return received;
+}
+
+
+void AccelStepperI2C::startBenchmark(I2Cwrapper* w)
+{
+  w->prepareCommand(benchmarkCmd);
+  w->buf.write(true);
+  w->sendCommand();
+}
+
+
+void AccelStepperI2C::stopBenchmark(I2Cwrapper* w)
+{
+  w->prepareCommand(benchmarkCmd);
+  w->buf.write(false);
+  w->sendCommand();
+}
+
+
+bool AccelStepperI2C::benchmarkResult(I2Cwrapper* w, BenchmarkResult& result)
+{
+  w->prepareCommand(benchmarkResultCmd);
+  if (w->sendCommand() and w->readResult(benchmarkResultResult)) {
+    w->buf.read(result.elapsed);
+    w->buf.read(result.cycles);
+    w->buf.read(result.maxCycleTime);
+    w->buf.read(result.messages);
+    return true;
+  }
+  return false;
+}
+
+
+bool AccelStepperI2C::stepTiming(StepTiming& timing)
+{
+  wrapper->prepareCommand(stepTimingCmd, myNum);
+  if (wrapper->sendCommand() and wrapper->readResult(stepTimingResult)) {
+    wrapper->buf.read(timing.steps);
+    wrapper->buf.read(timing.minInterval);
+    wrapper->buf.read(timing.maxInterval);
+    return true;
+  }
+  return false;
+}
+
+
+
+
+/*
+ *
+ * MultiStepperI2C
+ *
+ */
+
+// Constructor
+MultiStepperI2C::MultiStepperI2C(I2Cwrapper* w)
+{
+  wrapper = w;
+}
+
+
+bool MultiStepperI2C::addStepper(AccelStepperI2C& stepper)
+{
+  if (numMembers >= maxGroupSize) {
+    return false;
+  }
+  wrapper->prepareCommand(addToGroupCmd, stepper.myNum);
+  wrapper->buf.write(myNum); // -1 will make the target create a new group
+  int8_t res = -1;
+  if (wrapper->sendCommand() and wrapper->readResult(addToGroupResult)) {
+    wrapper->buf.read(res);
+  }
+  if (res < 0) {
+    return false;
+  }
+  myNum = res;
+  members[numMembers++] = &stepper;
+  log("Stepper "); log(stepper.myNum); log(" added to group "); log(myNum); log("\n");
+  return true;
+}
+
+
+void MultiStepperI2C::moveTo(long absolute[])
+{
+  wrapper->prepareCommand(groupMoveToCmd, myNum);
+  for (uint8_t m = 0; m < numMembers; m++) {
+    wrapper->buf.write((int32_t)absolute[m]);
+  }
   wrapper->sendCommand();
 }
 
+
+bool MultiStepperI2C::isRunning()
+{
+  for (uint8_t m = 0; m < numMembers; m++) {
+    if (members[m]->getState() != state_stopped) { // isRunning() would not work after runSpeedToPosition(), as speed remains set
+      return true;
+    }
+  }
+  return false;
+}
+
+
+// blocking
+void MultiStepperI2C::runSpeedToPosition()
+{
+  if (wrapper->listensToInterrupts() and allInterruptsEnabled()) { // no need to poll often
+    while (true) {
+      if (wrapper->waitFor(interruptReason_groupTargetReached, myNum, 100) != interruptReason_none) {
+        return;
+      }
+      // timeout: the group may have been stopped otherwise (e.g. by an endstop, which stops the
+      // whole group), or its interrupt may have been lost or overwritten by another one
+      if (not isRunning()) {
+        return;
+      }
+    }
+  }
+  while (isRunning()) {
+    delay(100); // see AccelStepperI2C::runToPosition()
+  }
+}
+
+
+bool MultiStepperI2C::onTargetReached(InterruptCallback callback)
+{
+  return wrapper->onInterrupt(callback, interruptReason_groupTargetReached, myNum);
+}
+
+
+// endstop and target reached interrupts are only sent for members with interrupts enabled
+bool MultiStepperI2C::allInterruptsEnabled()
+{
+  for (uint8_t m = 0; m < numMembers; m++) {
+    if (not members[m]->interruptsOn) {
+      return false;
+    }
+  }
+  return numMembers > 0;
+}
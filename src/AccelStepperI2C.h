@@ -15,7 +15,7 @@
   @todo ATM data is not protected against updates from ISRs while it is being
   used in the main program (see http://gammon.com.au/interrupts). Check if this
   could be a problem in our case.
-  @todo ESP32: make use of dual cores?
+  @todo <del>ESP32: make use of dual cores?</del> - ACCELSTEPPERI2C_DUAL_CORE firmware option
   @todo use interrupts for endstops instead of main loop polling (not sure how
   much of a difference this would make in practice, though. The main loop isn't
   doing much else, what really takes time are the computations.)
@@ -125,6 +125,106 @@ const uint8_t getStateCmd           = asCmdOffset + 29; const uint8_t getStateRe
 const uint8_t setEndstopPinCmd      = asCmdOffset + 30;
 const uint8_t enableEndstopsCmd     = asCmdOffset + 31;
 const uint8_t endstopsCmd           = asCmdOffset + 32; const uint8_t endstopsResult           = 1; // 1 uint8_t
+const uint8_t addToGroupCmd         = asCmdOffset + 33; const uint8_t addToGroupResult         = 1; // 1 int8_t
+const uint8_t groupMoveToCmd        = asCmdOffset + 34;
+const uint8_t queueMoveToCmd        = asCmdOffset + 35; const uint8_t queueMoveToResult        = 1; // 1 int8_t
+const uint8_t queueFreeCmd          = asCmdOffset + 36; const uint8_t queueFreeResult          = 1; // 1 int8_t
+const uint8_t clearQueueCmd         = asCmdOffset + 37;
+const uint8_t setQueueLowWaterCmd   = asCmdOffset + 38;
+
+/// @brief bytes used by one StepperStatus record in a transmission
+const uint8_t stepperStatusSize = 3 + 3 * 4; // 3 uint8_t, 2 int32_t, 1 float
+/// @brief StepperStatus records that fit into one reply, minus 1 byte for the CRC8 and 1 byte for the total number of records
+const uint8_t statusRecordsPerFrame = (I2CmaxBuf - 2) / stepperStatusSize;
+const uint8_t statusSnapshotCmd     = asCmdOffset + 39; const uint8_t statusSnapshotResult     = 1 + statusRecordsPerFrame * stepperStatusSize; // 1 uint8_t + records
+
+/*!
+ * @brief Status of one stepper as reported by AccelStepperI2C::statusSnapshot().
+ */
+struct StepperStatus
+{
+  uint8_t stepper;      ///< stepper number (myNum) this record belongs to
+  uint8_t state;        ///< state machine state, see AccelStepperI2C::getState()
+  uint8_t endstops;     ///< endstop states, see AccelStepperI2C::endstops()
+  long currentPosition; ///< see AccelStepperI2C::currentPosition()
+  long distanceToGo;    ///< see AccelStepperI2C::distanceToGo()
+  float speed;          ///< see AccelStepperI2C::speed()
+};
+
+/// @brief max. number of steppers in a MultiStepperI2C group, as all target positions need to fit into one transmission
+const uint8_t maxGroupSize = (I2CmaxBuf - 3) / sizeof(int32_t);
+
+// AccelStepperI2C commands, continued (reserved: 110 - 129 AccelStepperI2C)
+const uint8_t asCmdOffset2          = 110;
+
+const uint8_t benchmarkCmd          = asCmdOffset2 + 0;
+const uint8_t stepTimingCmd         = asCmdOffset2 + 1; const uint8_t stepTimingResult         = 3 * 4; // 3 uint32_t
+const uint8_t benchmarkResultCmd    = asCmdOffset2 + 2; const uint8_t benchmarkResultResult    = 4 * 4; // 4 uint32_t
+const uint8_t homeCmd               = asCmdOffset2 + 3;
+const uint8_t addPositionTriggerCmd = asCmdOffset2 + 4; const uint8_t addPositionTriggerResult = 1; // 1 int8_t
+const uint8_t clearPositionTriggersCmd = asCmdOffset2 + 5;
+const uint8_t firedTriggersCmd      = asCmdOffset2 + 6; const uint8_t firedTriggersResult      = 1; // 1 uint8_t
+const uint8_t setJerkCmd            = asCmdOffset2 + 7;
+const uint8_t jogCmd                = asCmdOffset2 + 8;
+const uint8_t setJogTimeoutCmd      = asCmdOffset2 + 9;
+const uint8_t stallDetectionCmd     = asCmdOffset2 + 10; // processed by the _stallDetection feature module
+const uint8_t followingErrorCmd     = asCmdOffset2 + 11; const uint8_t followingErrorResult     = 4; // 1 int32_t
+const uint8_t startRecordingCmd     = asCmdOffset2 + 12;
+const uint8_t stopRecordingCmd      = asCmdOffset2 + 13;
+const uint8_t motionSamplesCmd      = asCmdOffset2 + 14; const uint8_t motionSamplesResult      = I2CmaxBuf - 1; // 1 uint16_t + as many samples as fit, minus 1 byte for the CRC8
+/*
+ * MotionSamples are transmitted delta-coded, so that two of them fit into one
+ * reply: time relative to the previous sample, position relative to the
+ * previous sample of the same stepper. If there is no such sample within
+ * motionSampleSearchDepth, or a delta doesn't fit, the sample is sent in full.
+ * The first byte of a sample holds the stepper and one of these flags, 0 marks
+ * the unused rest of a reply.
+ */
+const uint8_t motionSampleCompact   = 0x40; // followed by 1 uint16_t time delta, 1 int16_t position delta, 1 int16_t speed
+const uint8_t motionSampleFull      = 0x80; // followed by 1 uint32_t time, 1 int32_t position, 1 float speed
+const uint8_t motionSampleCompactSize = 1 + 3 * 2;
+const uint8_t motionSampleFullSize  = 1 + 3 * 4;
+const uint8_t motionSampleSearchDepth = 16; // max. number of steppers
+
+/*!
+ * @brief One sample of the target's motion recorder, see 
+ * AccelStepperI2C::startRecording().
+ */
+struct MotionSample
+{
+  uint32_t time;        ///< microseconds since the recording was started
+  uint8_t stepper;      ///< stepper number (myNum) this sample belongs to
+  long position;        ///< see AccelStepperI2C::currentPosition()
+  float speed;          ///< see AccelStepperI2C::speed(), rounded to whole steps/s
+};
+
+/// @brief what a position trigger does with its output pin, see AccelStepperI2C::addPositionTrigger()
+const uint8_t triggerPinToggle      = 0; ///< invert the pin's level
+const uint8_t triggerPinHigh        = 1; ///< set the pin HIGH
+const uint8_t triggerPinLow         = 2; ///< set the pin LOW
+
+/*!
+ * @brief Step timing of one stepper as measured by the target's benchmark 
+ * mode, see AccelStepperI2C::stepTiming().
+ */
+struct StepTiming
+{
+  uint32_t steps;       ///< steps done since the benchmark was started
+  uint32_t minInterval; ///< shortest time between two steps in microseconds
+  uint32_t maxInterval; ///< longest time between two steps in microseconds
+};
+
+/*!
+ * @brief Overall results of the target's benchmark mode, see 
+ * AccelStepperI2C::benchmarkResult().
+ */
+struct BenchmarkResult
+{
+  uint32_t elapsed;      ///< duration of the benchmark in microseconds
+  uint32_t cycles;       ///< number of state machine cycles (i.e. target loop() passes)
+  uint32_t maxCycleTime; ///< longest time between two state machine cycles in microseconds
+  uint32_t messages;     ///< number of messages received from the controller
+};
 
 
 /// @brief stepper state machine states
@@ -132,6 +232,9 @@ const uint8_t state_stopped             = 0; ///< state machine is inactive, ste
 const uint8_t state_run                 = 1; ///< corresponds to AccelStepper::run(), will fall back to state_stopped if target reached or endstop hit
 const uint8_t state_runSpeed            = 2; ///< corresponds to AccelStepper::runSpeed(), will remain active until stopped by user or endstop
 const uint8_t state_runSpeedToPosition  = 3; ///< corresponds to AccelStepper::state_runSpeedToPosition(), will fall back to state_stopped if target position reached or endstop hit
+const uint8_t state_runQueue            = 4; ///< like state_run, but chains the queued segments, will fall back to state_stopped if the queue is empty and the last target reached or endstop hit
+const uint8_t state_homing              = 5; ///< homing sequence started by AccelStepperI2C::home(), will fall back to state_stopped when done or if something went wrong. Cannot be set with setState()
+const uint8_t state_jog                 = 6; ///< runSpeed() with speed ramped towards the last AccelStepperI2C::jog() speed, will fall back to state_stopped if jog commands cease or endstop hit. Cannot be set with setState()
 
 /*!
  * @ingroup InterruptReasons
@@ -140,6 +243,11 @@ const uint8_t state_runSpeedToPosition  = 3; ///< corresponds to AccelStepper::s
 const uint8_t interruptReason_targetReachedByRun = 1;
 const uint8_t interruptReason_targetReachedByRunSpeedToPosition = 2;
 const uint8_t interruptReason_endstopHit = 3;
+const uint8_t interruptReason_groupTargetReached = 5; ///< all members of a MultiStepperI2C group have reached their target, unit is the group's number
+const uint8_t interruptReason_queueLow = 6; ///< the stepper's segment queue has run down to its low water mark
+const uint8_t interruptReason_homingDone = 7; ///< the stepper's homing sequence has finished, its position is set
+const uint8_t interruptReason_positionTrigger = 8; ///< a position trigger has fired, see AccelStepperI2C::firedTriggers() for which one
+const uint8_t interruptReason_stallDetected = 9; ///< the stepper's following error exceeded its limit, see AccelStepperI2C::setStallDetection()
 /*!
  * @}
  */
@@ -237,7 +345,12 @@ public:
    * @brief This is a blocking function in the original, it will only return
    * after the target has been reached. This I2C implementation mimicks the
    * original, but uses the state machine and checks for a target reached condition
-   * with a fixed frequency of 100ms to keep the I2C bus uncluttered.
+   * with a fixed frequency of 100ms to keep the I2C bus uncluttered. If the 
+   * wrapper listens to interrupts (see I2Cwrapper::setControllerInterruptPin())
+   * and interrupts are enabled for this stepper, it will instead wait for the 
+   * target reached or endstop interrupt, and only check the stepper's state
+   * every 100ms in case it was stopped otherwise (e.g. by stall detection)
+   * or the interrupt got lost.
    * @note Does not check for endstops, implement your own loop if you need them.
    */
   void    runToPosition();
@@ -246,7 +359,7 @@ public:
    * @brief This is a blocking function in the original, it will only return
    * after the new target has been reached. This I2C implementation mimicks the
    * original, but uses the state machine and checks for a target reached condition
-   * with a fixed frequency of 100ms to keep the I2C bus uncluttered.
+   * like runToPosition().
    * @note Does not check for endstops, implement your own loop if you need them.
    */
   void    runToNewPosition(long position);
@@ -299,6 +412,24 @@ public:
    */
   void enableInterrupts(bool enable = true);
 
+  /*!
+   * @brief Register a function that will be called by 
+   * I2Cwrapper::handleInterrupts() or I2Cwrapper::waitFor() when this 
+   * stepper has reached its target in runState() or 
+   * runSpeedToPositionState(). Needs 
+   * I2Cwrapper::setControllerInterruptPin() and enableInterrupts().
+   * @param callback Function to call, see InterruptCallback.
+   * @returns false if no more callbacks can be registered with the wrapper.
+   */
+  bool onTargetReached(InterruptCallback callback);
+
+  /*!
+   * @brief Register a function that will be called by 
+   * I2Cwrapper::handleInterrupts() or I2Cwrapper::waitFor() when this 
+   * stepper has hit an endstop. See onTargetReached().
+   */
+  bool onEndstop(InterruptCallback callback);
+
   /*!
    * @brief Define a new endstop pin. Each stepper can have up to two, so don't
    * call this more than twice per stepper.
@@ -350,13 +481,13 @@ public:
 
   /*!
    * @brief Set the state machine's state manually.
-   * @param newState one of state_stopped, state_run, state_runSpeed, or state_runSpeedToPosition.
+   * @param newState one of state_stopped, state_run, state_runSpeed, state_runSpeedToPosition, or state_runQueue.
    */
   void setState(uint8_t newState);
 
   /*!
    * @brief Read the state machine's state (it may have been changed by endstop or target reached condition).
-   * @result one of state_stopped, state_run, state_runSpeed, or state_runSpeedToPosition.
+   * @result one of state_stopped, state_run, state_runSpeed, state_runSpeedToPosition, state_runQueue, state_homing, or state_jog.
    */
   uint8_t getState();
 
@@ -382,13 +513,378 @@ public:
    */
   void runSpeedToPositionState();
 
+  /*!
+   * @brief Run the complete homing sequence on the target: Approach the 
+   * endstop at fastSpeed until it is hit, back off at the same speed until it 
+   * is released again and at least backOff steps away from where it was hit, 
+   * then approach it again at slowSpeed. When the endstop is hit for the 
+   * second time, the stepper is stopped and its current position is set to 
+   * position. The state machine will be in state_homing while this is in 
+   * progress and will fall back to state_stopped afterwards, with an 
+   * interruptReason_homingDone interrupt if interrupts are enabled.
+   *
+   * If the endstop is already active when homing starts, the fast approach is
+   * skipped. If an endstop is hit while backing off (e.g. the one at the other 
+   * end), the stepper is stopped with an interruptReason_endstopHit interrupt
+   * and its position is left unchanged. Acceleration is not used, so choose 
+   * speeds the stepper can start and stop at.
+   *
+   * Needs at least one endstop defined with setEndstopPin(), else the command 
+   * will be ignored. The endstops don't need to be enabled with 
+   * enableEndstops().
+   * @param fastSpeed Speed for the first approach in steps per second, its
+   * sign gives the direction towards the endstop. The back off uses the 
+   * same speed in the opposite direction.
+   * @param slowSpeed Speed for the second approach in steps per second, the 
+   * sign is ignored.
+   * @param backOff Min. number of steps to back off after the first approach.
+   * @param position Position to set when homing is finished.
+   */
+  void home(float fastSpeed, float slowSpeed, long backOff, long position = 0);
+
+  /*!
+   * @brief Use a jerk limited (S-curve) profile instead of AccelStepper's 
+   * trapezoidal one when the state machine runs the stepper with runState().
+   * Acceleration will not jump to its full value at once, but rise and fall 
+   * linearly with the given jerk. This reduces vibrations and resonance, so 
+   * that often higher max. speeds and accelerations can be used. Max. speed 
+   * and acceleration are taken from setMaxSpeed() and setAcceleration().
+   * 
+   * The profile is only used by runState(), not by the controller calling 
+   * run() directly, nor by runQueueState(). As speed is computed every 1 ms 
+   * (2 ms on AVRs) only, with floats, this is more costly than AccelStepper's
+   * run(), esp. on AVRs.
+   * @param jerk Max. change of acceleration in steps per second³. A sensible 
+   * starting point is ten times the acceleration, i.e. full acceleration is 
+   * reached after 100 ms. 0 disables the S-curve profile (default).
+   */
+  void setJerk(float jerk);
+
+  /*!
+   * @brief Jog mode for manual control, e.g. with a jog wheel or joystick. 
+   * Each call sets a new target speed, the target will ramp the stepper's 
+   * speed towards it with the acceleration set with setAcceleration(). Call 
+   * it as often as the input changes, there's no need to wait for the 
+   * ramp to finish. The first call puts the state machine into state_jog.
+   *
+   * As a safety measure, the stepper will be ramped down to 0 and the state 
+   * machine stopped if no jog command arrives within the jog timeout (see 
+   * setJogTimeout()), e.g. because the controller or the bus failed. So keep
+   * repeating the last speed if the input doesn't change. stopState() stops 
+   * jogging immediately, without ramp.
+   * @param speed Target speed in steps per second, negative is anticlockwise.
+   */
+  void jog(float speed);
+
+  /*!
+   * @brief Set the jog watchdog's timeout, see jog().
+   * @param timeout Max. time in ms between two jog commands. Default is 500,
+   * 0 disables the watchdog.
+   */
+  void setJogTimeout(uint16_t timeout);
+
+  /*!
+   * @brief Link a rotary encoder attached to the same target to this stepper
+   * for stall detection. In each cycle, the target compares the stepper's 
+   * position to the position measured by the encoder. If the difference 
+   * (the following error) exceeds maxError, the stepper is stopped like 
+   * after an endstop hit, and an interrupt with reason 
+   * interruptReason_stallDetected is sent if interrupts are enabled. After a
+   * stall, call this again to re-arm the detection.
+   *
+   * Both positions are taken as reference when this is called. The target
+   * renews them itself when the stepper's position is set, i.e. by
+   * setCurrentPosition(), after home(), or by G92. After changing the
+   * encoder's position with RotaryEncoderI2C::setPosition(), call this
+   * again.
+   *
+   * Needs the target firmware compiled with the _stallDetection_firmware.h 
+   * feature module, else the command is ignored.
+   * @param encoder The encoder's unit number (RotaryEncoderI2C::myNum), -1 
+   * to unlink.
+   * @param stepsPerCount Stepper steps per encoder count, negative if the 
+   * encoder counts in the opposite direction.
+   * @param maxError Max. allowed following error in steps. Allow for the 
+   * encoder's resolution and some backlash.
+   * @param stop True (default) to stop the stepper on a stall, false to only
+   * send the interrupt.
+   */
+  void setStallDetection(int8_t encoder, float stepsPerCount, long maxError, bool stop = true);
+
+  /*!
+   * @brief Get the current difference between the stepper's position and 
+   * the position measured by its linked encoder, see setStallDetection().
+   * @returns Following error in steps, positive if the stepper lags behind.
+   * 0 if no encoder is linked or on transmission error.
+   */
+  long followingError();
+
+  /*!
+   * @brief Add a position trigger to the stepper. Whenever the stepper 
+   * crosses the given position (in either direction), the target will switch 
+   * an output pin and/or send an interrupt. As the triggers are checked by 
+   * the target's state machine right after each step, they are step-accurate 
+   * regardless of I2C latency, e.g. for firing a camera or a valve at exact 
+   * positions. Each stepper can have up to 4 (AVR) or 8 (other platforms) 
+   * triggers. Triggers only work while the state machine is running the stepper.
+   * @param position Stepper position that fires the trigger when reached 
+   * from either side.
+   * @param pin Output pin to switch, -1 for none. The pin will be set to 
+   * OUTPUT and LOW when the trigger is added.
+   * @param pinAction One of triggerPinToggle (default), triggerPinHigh, or 
+   * triggerPinLow. Toggling refers to the level set by this very trigger.
+   * @param interrupt Send an interrupt with reason 
+   * interruptReason_positionTrigger when fired. Needs interrupts enabled 
+   * with enableInterrupts().
+   * @returns Index of the new trigger (0 for the first one etc.), -1 if the
+   * stepper has no triggers left or on transmission error.
+   * @sa clearPositionTriggers(), firedTriggers()
+   */
+  int8_t addPositionTrigger(long position, int8_t pin, uint8_t pinAction = triggerPinToggle, bool interrupt = false);
+
+  /*!
+   * @brief Remove all of the stepper's position triggers. Their output pins 
+   * keep their current levels.
+   */
+  void clearPositionTriggers();
+
+  /*!
+   * @brief Find out which position triggers have fired since the last call.
+   * @returns One bit for each trigger, LSB is the trigger with index 0. 0 on 
+   * transmission error.
+   */
+  uint8_t firedTriggers();
+
+  /*!
+   * @brief Append a segment to the stepper's motion queue on the target. 
+   * Each segment is a moveTo() with its own max. speed and acceleration.
+   * The queue can be filled while the stepper is moving.
+   * @param absolute Target position of the segment.
+   * @param speed Max. speed used for the segment, see setMaxSpeed().
+   * @param acceleration Acceleration used for the segment, see setAcceleration().
+   * @returns Number of free queue slots after the segment was added, -1 if
+   * the queue was full (the segment was not added) or on transmission error.
+   * @sa runQueueState(), setQueueLowWater()
+   */
+  int8_t queueMoveTo(long absolute, float speed, float acceleration);
+
+  /*!
+   * @brief Get the number of free slots in the stepper's motion queue.
+   * @returns -1 on transmission error
+   */
+  int8_t queueFree();
+
+  /*!
+   * @brief Discard all segments in the stepper's motion queue which have not
+   * been started yet.
+   */
+  void clearQueue();
+
+  /*!
+   * @brief Make the target send an interrupt with reason 
+   * interruptReason_queueLow when, during runQueueState(), the number of 
+   * segments left in the queue drops to the given level. Use it to refill the 
+   * queue in time without having to poll queueFree(). Needs interrupts 
+   * enabled with enableInterrupts().
+   * @param level Number of remaining segments that triggers the interrupt,
+   * 0 (default) to disable.
+   */
+  void setQueueLowWater(uint8_t level);
+
+  /*!
+   * @brief Will work through the motion queue, i.e. poll run() for each 
+   * segment and start the next segment as soon as the current one is done. 
+   * If the next segment continues in the same direction, it will be started
+   * already when the stepper would otherwise start to decelerate, so that the
+   * stepper does not need to stop in between. Stops the state machine when
+   * the queue is empty and the last target has been reached (with an 
+   * interruptReason_targetReachedByRun interrupt). An endstop hit will 
+   * stop the stepper and clear the queue.
+   */
+  void runQueueState();
+
+  /*!
+   * @brief Get the status of all (or some) steppers of a target at once. 
+   * Instead of separate calls to currentPosition(), distanceToGo(), speed(), 
+   * getState() and endstops() for each stepper, the target takes a snapshot of 
+   * all selected steppers at the same moment and sends it in as few 
+   * transmissions as the I2C buffer size allows (currently one per stepper).
+   * @param w Wrapper object representing the target.
+   * @param status Array which receives one record for each selected stepper,
+   * in the order of their stepper numbers.
+   * @param maxRecords Size of the status array.
+   * @param mask One bit for each stepper to include, bit 0 for stepper 0 etc.
+   * Defaults to all steppers. Bits of unknown steppers are ignored.
+   * @returns Number of records stored in the status array, 0 on transmission 
+   * error (check I2Cwrapper::resultOK). 
+   */
+  static uint8_t statusSnapshot(I2Cwrapper* w, StepperStatus status[], uint8_t maxRecords, uint16_t mask = 0xffff);
+
+  /*!
+   * @brief Start the target's motion recorder. It will sample position and 
+   * speed of the selected steppers at a fixed rate into a ring buffer in the 
+   * target's RAM, without any bus traffic, until stopped or fetched with 
+   * fetchRecording(). The buffer holds 24 samples on AVRs and 512 on other
+   * platforms; if it is full, the oldest samples are overwritten. A new 
+   * recording discards the previous one.
+   * @param w Wrapper object representing the target.
+   * @param interval Time between samples in microseconds. As samples are 
+   * taken by the state machine, don't expect much below 1000 µs.
+   * @param mask Steppers to sample, see statusSnapshot(). Each selected 
+   * stepper takes one sample per interval.
+   */
+  static void startRecording(I2Cwrapper* w, uint32_t interval, uint16_t mask = 0xffff);
+
+  /*!
+   * @brief Stop the target's motion recorder, see startRecording().
+   * @param w Wrapper object representing the target.
+   */
+  static void stopRecording(I2Cwrapper* w);
+
+  /*!
+   * @brief Fetch the motion recorder's samples from the target, oldest 
+   * first. Will stop the recorder, so that the samples don't change while 
+   * they are being fetched. Samples are delta-coded, so that usually two of
+   * them fit into one transmission. Still, better not do this during moves
+   * which need the bus.
+   * @param w Wrapper object representing the target.
+   * @param samples Array which receives the samples.
+   * @param maxSamples Size of the samples array.
+   * @returns Number of samples stored in the array, 0 on transmission 
+   * error (check I2Cwrapper::resultOK).
+   */
+  static uint16_t fetchRecording(I2Cwrapper* w, MotionSample samples[], uint16_t maxSamples);
+
+  /*!
+   * @brief Start the target's benchmark mode. The target will count the 
+   * steps of each stepper and measure the time between them, as well as the 
+   * time the state machine needs for one cycle, until stopBenchmark() is 
+   * called. Compare the results to the speeds you requested to find out how 
+   * many steppers at which speeds a given target can handle, with and without
+   * concurrent I2C traffic. See the Stepper_Benchmark example.
+   * @param w Wrapper object representing the target.
+   * @note Needs a firmware compiled with ACCELSTEPPERI2C_BENCHMARK defined
+   * in AccelStepperI2C_firmware.h.
+   */
+  static void startBenchmark(I2Cwrapper* w);
+
+  /*!
+   * @brief Stop the target's benchmark mode, so that the results can be read 
+   * with benchmarkResult() and stepTiming().
+   * @param w Wrapper object representing the target.
+   */
+  static void stopBenchmark(I2Cwrapper* w);
+
+  /*!
+   * @brief Get the overall results of the last (or current) benchmark.
+   * @param w Wrapper object representing the target.
+   * @param result Receives the results.
+   * @returns false on transmission error (or if the firmware was compiled 
+   * without benchmark mode).
+   */
+  static bool benchmarkResult(I2Cwrapper* w, BenchmarkResult& result);
+
+  /*!
+   * @brief Get this stepper's step timing measured during the last (or 
+   * current) benchmark. The achieved step rate is steps * 1e6 / elapsed 
+   * (see benchmarkResult()), the jitter maxInterval - minInterval.
+   * @param timing Receives the timing.
+   * @returns false on transmission error (or if the firmware was compiled 
+   * without benchmark mode).
+   */
+  bool stepTiming(StepTiming& timing);
+
   int8_t myNum = -1;    ///< Stepper number with myNum >= 0 for successfully added steppers.
 
 private:
+  friend class MultiStepperI2C;
+  bool interruptsOn = false; // mirrors enableInterrupts()
   //uint8_t attach(uint8_t interface = AccelStepper::FULL4WIRE, uint8_t pin1 = 2, uint8_t pin2 = 3, uint8_t pin3 = 4, uint8_t pin4 = 5, bool enable = true);
   I2Cwrapper* wrapper;
 
 };
 
 
+/*****************************************************************************/
+/*****************************************************************************/
+
+/*!
+  @brief An I2C wrapper class for AccelStepper's [MultiStepper class](https://www.airspayce.com/mikem/arduino/AccelStepper/classMultiStepper.html).
+  @details
+  Groups up to @ref maxGroupSize steppers of the same target, so that they
+  can be moved in a coordinated way: The target will compute each member's 
+  constant speed so that all of them arrive at their new positions at the 
+  same time. As the computation is done by the target, a coordinated move 
+  needs only one transmission, regardless of the number of members.
+  @note Just like the original, MultiStepperI2C uses constant speeds, 
+  acceleration is not supported.
+*/
+class MultiStepperI2C
+{
+public:
+  /*!
+   * @brief Constructor.
+   * @param w Wrapper object representing the target the steppers are connected to.
+   */
+  MultiStepperI2C(I2Cwrapper* w);
+
+  /*!
+   * @brief Add a stepper to the group. The first call will create the group 
+   * on the target's side. Check @ref myNum >= 0 to see if that was successful.
+   * @param stepper An already attached stepper of the target this group 
+   * belongs to.
+   * @returns true if the stepper was added, false if the group is full, the
+   * target has no free group left, or a transmission error occurred.
+   */
+  bool addStepper(AccelStepperI2C& stepper);
+
+  /*!
+   * @brief Set new target positions for all members. Unlike the original,
+   * this will also start the members' state machines in 
+   * state_runSpeedToPosition, so there's no need to call run(). An 
+   * interrupt with reason interruptReason_groupTargetReached will be sent, 
+   * if interrupts are enabled for any member, when the last member arrives.
+   * The members' own target reached interrupts are suppressed during the move.
+   * If a member hits an enabled endstop, all members will be stopped.
+   * @param absolute Array of target positions, one for each member in the 
+   * order they were added.
+   */
+  void moveTo(long absolute[]);
+
+  /*!
+   * @brief Returns true if any member's state machine is still running.
+   */
+  bool isRunning();
+
+  /*!
+   * @brief This is a blocking function in the original, it will only return
+   * after all members have arrived. Like AccelStepperI2C::runToPosition()
+   * this I2C implementation checks with a fixed frequency of 100ms to keep 
+   * the I2C bus uncluttered, or, if the wrapper listens to interrupts and
+   * interrupts are enabled for all members, waits for the group's target 
+   * reached interrupt. In the latter case, it still checks the members'
+   * states every 100ms, so that it also returns if the group was stopped
+   * otherwise (e.g. by an endstop) or the interrupt got lost.
+   */
+  void runSpeedToPosition();
+
+  /*!
+   * @brief Register a function that will be called by 
+   * I2Cwrapper::handleInterrupts() or I2Cwrapper::waitFor() when all members
+   * have arrived. The callback's unit parameter is the group number (myNum).
+   * See AccelStepperI2C::onTargetReached().
+   */
+  bool onTargetReached(InterruptCallback callback);
+
+  int8_t myNum = -1;    ///< Group number with myNum >= 0 for successfully created groups.
+
+private:
+  I2Cwrapper* wrapper;
+  AccelStepperI2C* members[maxGroupSize];
+  uint8_t numMembers = 0;
+  bool allInterruptsEnabled();
+
+};
+
+
 #endif
@@ -46,6 +46,10 @@ void ESP32sensorsI2C::enableInterrupts(uint8_t pin, uint16_t threshold, bool fal
   wrapper->sendCommand();  
 }
 
+bool ESP32sensorsI2C::onTouch(InterruptCallback callback, uint8_t pin) {
+  return wrapper->onInterrupt(callback, interruptReason_ESP32sensorsTouch, pin);
+}
+
 int ESP32sensorsI2C::hallRead() {
   wrapper->prepareCommand(ESP32sensorsHallReadCmd, myNum);
   int16_t res = -1;
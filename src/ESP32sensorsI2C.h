@@ -92,6 +92,18 @@ public:
    * Uses touchInterruptSetThresholdDirection().
    */
   void enableInterrupts(uint8_t pin, uint16_t threshold, bool falling = true);
+
+  /*!
+   * @brief Register a function that will be called by 
+   * I2Cwrapper::handleInterrupts() or I2Cwrapper::waitFor() when a touch 
+   * interrupt comes in. Needs I2Cwrapper::setControllerInterruptPin() and 
+   * enableInterrupts().
+   * @param callback Function to call, see InterruptCallback. Its unit 
+   * parameter is the touch pin number (0 to 9).
+   * @param pin Touch pin (0 to 9) to react to, anyUnit (default) for all.
+   * @returns false if no more callbacks can be registered with the wrapper.
+   */
+  bool onTouch(InterruptCallback callback, uint8_t pin = anyUnit);
   int hallRead();
   float temperatureRead();
   
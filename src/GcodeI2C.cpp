@@ -0,0 +1,147 @@
+/*!
+  @file GcodeI2C.cpp
+  @brief Part of the I2Cwrapper firmware/library
+  ## Author
+  Copyright (c) 2023 juh
+  ## License
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation, version 2.
+*/
+
+
+#include <GcodeI2C.h>
+#include <AccelStepperI2C.h>
+
+
+const uint8_t myNum = 253; // fake myNum, as there is only one G-code interpreter per target
+
+// Constructor
+GcodeI2C::GcodeI2C(I2Cwrapper* w)
+{
+  wrapper = w;
+}
+
+
+void GcodeI2C::setAxis(uint8_t axis, AccelStepperI2C& stepper, float stepsPerUnit)
+{
+  wrapper->prepareCommand(gcodeSetAxisCmd, myNum);
+  wrapper->buf.write(axis);
+  wrapper->buf.write(stepper.myNum);
+  wrapper->buf.write(stepsPerUnit);
+  wrapper->sendCommand();
+}
+
+
+void GcodeI2C::setHoming(uint8_t axis, float fastSpeed, float slowSpeed, float backOff)
+{
+  wrapper->prepareCommand(gcodeSetHomingCmd, myNum);
+  wrapper->buf.write(axis);
+  wrapper->buf.write(fastSpeed);
+  wrapper->buf.write(slowSpeed);
+  wrapper->buf.write(backOff);
+  wrapper->sendCommand();
+}
+
+
+void GcodeI2C::setMotion(float rapidFeed, float acceleration)
+{
+  wrapper->prepareCommand(gcodeSetMotionCmd, myNum);
+  wrapper->buf.write(rapidFeed);
+  wrapper->buf.write(acceleration);
+  wrapper->sendCommand();
+}
+
+
+int8_t GcodeI2C::sendLine(const char* line)
+{
+  const uint8_t maxChunk = I2CmaxBuf - 3; // command, unit, and CRC8 bytes
+  bool lineEnd = false;
+  while (not lineEnd) {
+    wrapper->prepareCommand(gcodeLineCmd, myNum);
+    for (uint8_t i = 0; i < maxChunk; i++) {
+      char c = *line;
+      if ((c == '\0') or (c == '\n')) { // make sure the line is terminated
+        wrapper->buf.write('\n');
+        lineEnd = true;
+        break;
+      }
+      wrapper->buf.write(c);
+      line++;
+    }
+    if (not wrapper->sendCommand()) {
+      return -1;
+    }
+  }
+  int8_t res = -1;
+  if (wrapper->readResult(gcodeLineResult)) { // only the last chunk's reply is of interest
+    wrapper->buf.read(res);
+  }
+  return res;
+}
+
+
+int8_t GcodeI2C::sendBlockFrame(uint8_t code, uint8_t words, const float values[], uint8_t numValues)
+{
+  wrapper->prepareCommand(gcodeBlockCmd, myNum);
+  wrapper->buf.write(code);
+  wrapper->buf.write(words);
+  for (uint8_t i = 0; i < numValues; i++) {
+    wrapper->buf.write(values[i]);
+  }
+  int8_t res = -1;
+  if (wrapper->sendCommand() and wrapper->readResult(gcodeBlockResult)) {
+    wrapper->buf.read(res);
+  }
+  return res;
+}
+
+
+int8_t GcodeI2C::sendBlock(uint8_t code, uint8_t words, const float values[])
+{
+  uint8_t numValues = 0;
+  for (uint8_t w = 0; w <= gcodeNumAxes; w++) {
+    if (words & (1 << w)) {
+      numValues++;
+    }
+  }
+  if ((numValues > gcodeMaxBlockValues) and (words & gcodeWordF)) { // feed rate first, on its own
+    if (sendBlockFrame(1, gcodeWordF, &values[numValues - 1], 1) < 0) {
+      return -1;
+    }
+    words &= ~gcodeWordF;
+    numValues--;
+  }
+  return sendBlockFrame(code, words, values, numValues);
+}
+
+
+int8_t GcodeI2C::free()
+{
+  wrapper->prepareCommand(gcodeStatusCmd, myNum);
+  int8_t res = -1;
+  if (wrapper->sendCommand() and wrapper->readResult(gcodeStatusResult)) {
+    wrapper->buf.read(res);
+  }
+  return res;
+}
+
+
+bool GcodeI2C::idle()
+{
+  wrapper->prepareCommand(gcodeStatusCmd, myNum);
+  int8_t free = -1;
+  bool res = false;
+  if (wrapper->sendCommand() and wrapper->readResult(gcodeStatusResult)) {
+    wrapper->buf.read(free);
+    wrapper->buf.read(res);
+  }
+  return res;
+}
+
+
+void GcodeI2C::clear()
+{
+  wrapper->prepareCommand(gcodeClearCmd, myNum);
+  wrapper->sendCommand();
+}
@@ -0,0 +1,182 @@
+/*!
+  @file GcodeI2C.h
+  @brief Arduino library for streaming G-code to a target which runs the
+  I2Cwrapper @ref firmware.ino with the AccelStepperI2C and GcodeI2C modules
+  enabled.
+
+  Instead of translating each line of a toolpath into a bunch of
+  AccelStepperI2C calls, the controller sends the G-code line itself (or a
+  compact binary version of it). The target plans it into its stepper state
+  machine and buffers the following lines, so that the controller only needs
+  to keep the buffer filled.
+  ## Author
+  Copyright (c) 2023 juh
+  ## License
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation, version 2.
+*/
+
+
+#ifndef GcodeI2C_h
+#define GcodeI2C_h
+
+// #define DEBUG // uncomment for serial debugging, don't forget Serial.begin() in your controller's setup()
+
+
+#include <Arduino.h>
+#include <I2Cwrapper.h>
+
+
+#if !defined(log)
+#if defined(DEBUG)
+#define log(...)       Serial.print(__VA_ARGS__)
+#else
+#define log(...)
+#endif // DEBUG
+#endif // log
+
+class AccelStepperI2C;
+
+
+// G-code commands (reserved 160 - 169 GcodeI2C)
+const uint8_t gcodeCmdOffset        = 160;
+const uint8_t gcodeSetAxisCmd       = gcodeCmdOffset + 0;
+const uint8_t gcodeSetHomingCmd     = gcodeCmdOffset + 1;
+const uint8_t gcodeSetMotionCmd     = gcodeCmdOffset + 2;
+const uint8_t gcodeLineCmd          = gcodeCmdOffset + 3; const uint8_t gcodeLineResult        = 1; // 1 int8_t
+const uint8_t gcodeBlockCmd         = gcodeCmdOffset + 4; const uint8_t gcodeBlockResult       = 1; // 1 int8_t
+const uint8_t gcodeStatusCmd        = gcodeCmdOffset + 5; const uint8_t gcodeStatusResult      = 2; // 1 int8_t, 1 bool
+const uint8_t gcodeClearCmd         = gcodeCmdOffset + 6;
+
+/// @brief axes known to the G-code interpreter
+const uint8_t gcodeAxisX = 0;
+const uint8_t gcodeAxisY = 1;
+const uint8_t gcodeAxisZ = 2;
+const uint8_t gcodeNumAxes = 3;
+
+/// @brief words of a binary G-code block, see GcodeI2C::sendBlock()
+const uint8_t gcodeWordX = 1 << gcodeAxisX;
+const uint8_t gcodeWordY = 1 << gcodeAxisY;
+const uint8_t gcodeWordZ = 1 << gcodeAxisZ;
+const uint8_t gcodeWordF = 1 << gcodeNumAxes;
+
+/// @brief max. number of values in one binary block transmission
+const uint8_t gcodeMaxBlockValues = (I2CmaxBuf - 3 - 2) / sizeof(float);
+
+
+/*!
+  @brief An I2C wrapper class for a target-side G-code interpreter.
+  @details
+  Supports a small subset of G-code, enough for pen plotters and light CNC
+  work:
+  * G0, G1: linear move with rapid or set feed rate (F, in units per minute)
+  * G28: home the given axes (all if none given), see setHoming()
+  * G90, G91: absolute (default) or relative coordinates
+  * G92: set the current position of the given axes
+
+  Axis words are X, Y, and Z, line numbers (N) and comments (";" and "()")
+  are ignored. Units are whatever stepsPerUnit in setAxis() refers to.
+
+  All axes of a move start together, their speeds and accelerations are
+  scaled so that they also arrive together. There's no look-ahead, i.e. each
+  move starts and ends with zero speed.
+
+  The interpreter uses the steppers' state machines, so the steppers must not
+  be moved otherwise while G-code is executed. If an axis is stopped by an
+  endstop (outside of G28) or by stall detection, the target stops all
+  axes, discards the buffered blocks and rejects all further ones, i.e.
+  sendLine(), sendBlock(), and free() return -1, until clear() is called.
+  */
+class GcodeI2C
+{
+public:
+
+  /*!
+   * @brief Constructor.
+   * @param w Wrapper object representing the target the steppers are connected to.
+   */
+  GcodeI2C(I2Cwrapper* w);
+
+  /*!
+   * @brief Assign a stepper to an axis.
+   * @param axis One of gcodeAxisX, gcodeAxisY, or gcodeAxisZ.
+   * @param stepper Stepper attached to the same target.
+   * @param stepsPerUnit Steps per mm (or whatever unit the G-code uses),
+   * negative to invert the axis.
+   */
+  void setAxis(uint8_t axis, AccelStepperI2C& stepper, float stepsPerUnit);
+
+  /*!
+   * @brief Define how G28 homes an axis, see AccelStepperI2C::home(). The
+   * axis' stepper needs an endstop, else G28 for the axis is rejected. The
+   * homed position is 0.
+   * @param axis One of gcodeAxisX, gcodeAxisY, or gcodeAxisZ.
+   * @param fastSpeed Speed for the first approach in units per second, its
+   * sign gives the direction towards the endstop.
+   * @param slowSpeed Speed for the second approach in units per second.
+   * @param backOff Min. distance to back off in units.
+   */
+  void setHoming(uint8_t axis, float fastSpeed, float slowSpeed, float backOff);
+
+  /*!
+   * @brief Set the speed of rapid moves (G0) and the acceleration of all
+   * moves. Defaults are 3000 units/min and 100 units/s².
+   * @param rapidFeed Speed of G0 moves in units per minute.
+   * @param acceleration Acceleration in units/s².
+   */
+  void setMotion(float rapidFeed, float acceleration);
+
+  /*!
+   * @brief Send one line of G-code. Long lines are split in as many
+   * transmissions as needed.
+   * @param line G-code line, with or without line end.
+   * @returns Free slots in the target's block buffer after the line was
+   * processed, -1 if the line (or a previous one since the last reply) was
+   * rejected because of a syntax error, an unknown command, or a full buffer,
+   * after an endstop or stall stop (see clear()), or on transmission error. Make sure there is a free slot before
+   * sending the next line.
+   */
+  int8_t sendLine(const char* line);
+
+  /*!
+   * @brief Send a pre-tokenized G-code block, i.e. a line without the need
+   * to parse text on the target.
+   * @param code G code, e.g. 1 for G1.
+   * @param words Words that are present, any combination of gcodeWordX,
+   * gcodeWordY, gcodeWordZ, and gcodeWordF.
+   * @param values Values of the words present, in the order X, Y, Z, F.
+   * If there are more than gcodeMaxBlockValues, F is sent in a transmission
+   * of its own.
+   * @returns see sendLine()
+   */
+  int8_t sendBlock(uint8_t code, uint8_t words, const float values[]);
+
+  /*!
+   * @brief Get the number of free slots in the target's block buffer.
+   * @returns -1 after an endstop or stall stop (see clear()) or on
+   * transmission error
+   */
+  int8_t free();
+
+  /*!
+   * @brief Find out if the target has finished all G-code sent so far.
+   * @returns true if all blocks are done, false if not or on transmission error
+   */
+  bool idle();
+
+  /*!
+   * @brief Discard all buffered blocks and partial lines. A move in progress
+   * will be finished. Also clears the fault after an endstop or stall stop,
+   * so that new blocks are accepted again.
+   */
+  void clear();
+
+private:
+  I2Cwrapper* wrapper;
+  int8_t sendBlockFrame(uint8_t code, uint8_t words, const float values[], uint8_t numValues);
+
+};
+
+
+#endif
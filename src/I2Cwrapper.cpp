@@ -198,6 +198,98 @@ uint8_t I2Cwrapper::clearInterrupt()
   return res;
 }
 
+
+/*
+   Controller side interrupt handling. attachInterrupt() needs plain
+   functions, so each wrapper gets one of a fixed number of static ISRs.
+*/
+
+I2Cwrapper* I2Cwrapper::interruptWrappers[maxInterruptWrappers] = {nullptr};
+
+#if defined(ARDUINO_ARCH_ESP32) || defined(ARDUINO_ARCH_ESP8266)
+#define I2CWRAPPER_ISR IRAM_ATTR
+#else
+#define I2CWRAPPER_ISR
+#endif
+
+void I2CWRAPPER_ISR I2Cwrapper::interruptISR0() { interruptWrappers[0]->interruptFlag = true; }
+void I2CWRAPPER_ISR I2Cwrapper::interruptISR1() { interruptWrappers[1]->interruptFlag = true; }
+void I2CWRAPPER_ISR I2Cwrapper::interruptISR2() { interruptWrappers[2]->interruptFlag = true; }
+void I2CWRAPPER_ISR I2Cwrapper::interruptISR3() { interruptWrappers[3]->interruptFlag = true; }
+
+bool I2Cwrapper::setControllerInterruptPin(uint8_t pin, bool activeHigh)
+{
+  static void (* const isrs[maxInterruptWrappers])() = {interruptISR0, interruptISR1, interruptISR2, interruptISR3};
+  uint8_t w = 0;
+  while ((w < maxInterruptWrappers) and (interruptWrappers[w] != nullptr) and (interruptWrappers[w] != this)) {
+    w++;
+  }
+  if (w == maxInterruptWrappers) {
+    return false;
+  }
+  interruptWrappers[w] = this;
+  pinMode(pin, INPUT);
+  interruptFlag = false;
+  attachInterrupt(digitalPinToInterrupt(pin), isrs[w], activeHigh ? RISING : FALLING);
+  interruptsAttached = true;
+  return true;
+}
+
+bool I2Cwrapper::listensToInterrupts()
+{
+  return interruptsAttached;
+}
+
+bool I2Cwrapper::onInterrupt(InterruptCallback callback, uint8_t reason, uint8_t unit)
+{
+  if (numInterruptHandlers >= maxInterruptCallbacks) {
+    return false;
+  }
+  interruptHandlers[numInterruptHandlers++] = {callback, reason, unit};
+  return true;
+}
+
+void I2Cwrapper::clearCallbacks()
+{
+  numInterruptHandlers = 0;
+}
+
+uint8_t I2Cwrapper::handleInterrupts()
+{
+  if (not interruptFlag) {
+    return 0;
+  }
+  interruptFlag = false; // clear before asking the target, so that we won't miss the next one
+  uint8_t reasonAndUnit = clearInterrupt();
+  if (reasonAndUnit == 0xff) { // transmission error
+    return 0;
+  }
+  uint8_t reason = reasonAndUnit >> 4;
+  uint8_t unit = reasonAndUnit & 0xf;
+  for (uint8_t h = 0; h < numInterruptHandlers; h++) {
+    if (((interruptHandlers[h].reason == anyReason) or (interruptHandlers[h].reason == reason))
+        and ((interruptHandlers[h].unit == anyUnit) or (interruptHandlers[h].unit == unit))) {
+      interruptHandlers[h].callback(unit, reason);
+    }
+  }
+  return reasonAndUnit;
+}
+
+uint8_t I2Cwrapper::waitFor(uint8_t reason, uint8_t unit, unsigned long timeout)
+{
+  unsigned long start = millis();
+  while ((timeout == 0) or (millis() - start < timeout)) {
+    uint8_t reasonAndUnit = handleInterrupts();
+    if ((reasonAndUnit != 0)
+        and ((reason == anyReason) or (reason == reasonAndUnit >> 4))
+        and ((unit == anyUnit) or (unit == (reasonAndUnit & 0xf)))) {
+      return reasonAndUnit >> 4;
+    }
+    yield();
+  }
+  return interruptReason_none;
+}
+
 uint32_t I2Cwrapper::getVersion()
 {
   prepareCommand(getVersionCmd);
@@ -62,6 +62,24 @@ const uint8_t pingBackCmd           = 246; // has variable result length, so no
  */
 const uint8_t interruptReason_none = 0; ///< You should not encounter this in practice, as you don't want to be interrupted without a reason...
 
+/// @brief Wildcard for I2Cwrapper::onInterrupt() and I2Cwrapper::waitFor(), matches any interrupt reason
+const uint8_t anyReason = 0xff;
+/// @brief Wildcard for I2Cwrapper::onInterrupt() and I2Cwrapper::waitFor(), matches any unit
+const uint8_t anyUnit = 0xff;
+
+/*!
+ * @brief Callback function for interrupts from the target, see 
+ * I2Cwrapper::onInterrupt().
+ * @param unit Unit (stepper, touch pin, ...) that caused the interrupt
+ * @param reason Reason for the interrupt, see InterruptReasons
+ */
+typedef void (*InterruptCallback)(uint8_t unit, uint8_t reason);
+
+/// @brief max. number of callbacks that can be registered per wrapper with I2Cwrapper::onInterrupt()
+const uint8_t maxInterruptCallbacks = 8;
+/// @brief max. number of wrappers that can listen to interrupts with I2Cwrapper::setControllerInterruptPin()
+const uint8_t maxInterruptWrappers = 4;
+
 /*****************************************************************************/
 /*****************************************************************************/
 
@@ -82,7 +100,12 @@ const uint8_t interruptReason_none = 0; ///< You should not encounter this in pr
  * * 075 - 079 (reserved for soon to come SonarI2C)
  * * 080 - 089 TM1638liteI2C
  * * 090 - 109 UcglibI2C
- * * 110 - 239 (unused)
+ * * 110 - 129 AccelStepperI2C (continued)
+ * * 130 - 149 RotaryEncoderI2C
+ * * 150 - 159 ServoI2C (continued)
+ * * 160 - 169 GcodeI2C
+ * * 170 - 179 PinI2C (continued)
+ * * 180 - 239 (unused)
  * * 240 - 255 I2Cwrapper commands (reset target, change address etc.)
  * @par
  * New classes can use I2Cwrapper to easily add even more capabilities
@@ -156,6 +179,64 @@ public:
    */
   uint8_t clearInterrupt();
 
+  /*!
+   * @brief Make the wrapper listen to the target's interrupts, so that you 
+   * don't need to write your own interrupt service routine. Connect the 
+   * target's interrupt pin (see setInterruptPin()) to an interrupt capable 
+   * pin of the controller. Interrupts are then registered in the background
+   * and dispatched by handleInterrupts() or waitFor() outside of the ISR, so 
+   * that they can safely use I2C to clear and decode them.
+   * @param pin Controller's pin, must be usable with attachInterrupt().
+   * @param activeHigh Must match the setting given to setInterruptPin().
+   * @returns false if too many (maxInterruptWrappers) wrappers already listen 
+   * to interrupts.
+   */
+  bool setControllerInterruptPin(uint8_t pin, bool activeHigh = true);
+
+  /*!
+   * @brief Register a function that is called by handleInterrupts() and 
+   * waitFor() for interrupts with the given reason and unit. Modules offer 
+   * more convenient ways to register callbacks, e.g. 
+   * AccelStepperI2C::onTargetReached().
+   * @param callback Function to call, see InterruptCallback
+   * @param reason Reason to react to, see InterruptReasons, or anyReason.
+   * @param unit Unit to react to, or anyUnit.
+   * @returns false if maxInterruptCallbacks callbacks were already registered.
+   */
+  bool onInterrupt(InterruptCallback callback, uint8_t reason = anyReason, uint8_t unit = anyUnit);
+
+  /*!
+   * @brief Remove all callbacks registered with onInterrupt().
+   */
+  void clearCallbacks();
+
+  /*!
+   * @brief Check if an interrupt has come in since the last call. If so, clear
+   * it with clearInterrupt() and call all matching callbacks. Call this 
+   * regularly from your sketch's loop().
+   * @returns The interrupt as returned by clearInterrupt() (reason in the 
+   * upper, unit in the lower 4 bits), or 0 if there was none.
+   */
+  uint8_t handleInterrupts();
+
+  /*!
+   * @brief Wait for an interrupt with the given reason and unit. Other 
+   * interrupts coming in meanwhile are dispatched to their callbacks, just 
+   * like handleInterrupts() does, but won't end the wait. Needs 
+   * setControllerInterruptPin().
+   * @param reason Reason to wait for, see InterruptReasons, or anyReason.
+   * @param unit Unit to wait for, or anyUnit.
+   * @param timeout Max. time to wait in ms, 0 (default) to wait forever.
+   * @returns Reason of the interrupt that ended the wait, interruptReason_none 
+   * on timeout.
+   */
+  uint8_t waitFor(uint8_t reason = anyReason, uint8_t unit = anyUnit, unsigned long timeout = 0);
+
+  /*!
+   * @returns true if setControllerInterruptPin() was used successfully.
+   */
+  bool listensToInterrupts();
+
   /*!
    * @brief Define a minimum duration of time that the controller keeps between 
    * I2C transmissions. This is to make sure that the target has finished its 
@@ -275,6 +356,21 @@ private:
   bool pingBack(uint8_t testData, uint8_t testLength);
   
   void doDelay();
+  static void interruptISR0();
+  static void interruptISR1();
+  static void interruptISR2();
+  static void interruptISR3();
+  static I2Cwrapper* interruptWrappers[maxInterruptWrappers];
+  struct InterruptHandler
+  {
+    InterruptCallback callback;
+    uint8_t reason;
+    uint8_t unit;
+  };
+  InterruptHandler interruptHandlers[maxInterruptCallbacks];
+  uint8_t numInterruptHandlers = 0;
+  volatile bool interruptFlag = false; // set by ISR
+  bool interruptsAttached = false;
   uint8_t address;
   // ms to wait between I2C communication, can be changed by setI2Cdelay()
   unsigned long I2Cdelay = I2CdefaultDelay;
@@ -67,3 +67,58 @@ void PinI2C::analogWrite(uint8_t pin, int value){
   wrapper->buf.write((int16_t)value);
   wrapper->sendCommand();
 }
+
+void PinI2C::startCapture(const uint8_t pins[], uint8_t numPins, uint32_t interval){
+  wrapper->prepareCommand(pinStartCaptureCmd, myNum);
+  wrapper->buf.write(interval);
+  for (uint8_t p = 0; (p < numPins) and (p < maxCapturePins); p++) {
+    wrapper->buf.write(pins[p]);
+  }
+  wrapper->sendCommand();
+}
+
+void PinI2C::setCaptureTrigger(uint8_t mask, uint8_t value, uint16_t postTrigger){
+  wrapper->prepareCommand(pinCaptureTriggerCmd, myNum);
+  wrapper->buf.write(mask);
+  wrapper->buf.write(value);
+  wrapper->buf.write(postTrigger);
+  wrapper->sendCommand();
+}
+
+uint8_t PinI2C::captureState(){
+  wrapper->prepareCommand(pinCaptureStateCmd, myNum);
+  uint8_t res = 0xff;
+  if (wrapper->sendCommand() and wrapper->readResult(pinCaptureStateResult)) {
+    wrapper->buf.read(res);
+  }
+  return res;
+}
+
+uint16_t PinI2C::fetchCapture(CaptureSample samples[], uint16_t maxSamples){
+  uint16_t numSamples = 0; // total number of samples on the target, known after the first transmission
+  uint16_t received = 0;
+  do {
+    wrapper->prepareCommand(pinCaptureSamplesCmd, myNum);
+    wrapper->buf.write(received); // first sample to send, 0 makes the target stop capturing
+    if (not (wrapper->sendCommand() and wrapper->readResult(pinCaptureSamplesResult))) {
+      return 0;
+    }
+    wrapper->buf.read(numSamples);
+    for (uint8_t r = 0; (r < captureSamplesPerFrame) and (received < numSamples) and (received < maxSamples); r++) {
+      CaptureSample* c = &samples[received++];
+      wrapper->buf.read(c->time);
+      wrapper->buf.read(c->pins);
+    }
+  } while ((received < numSamples) and (received < maxSamples));
+  return received;
+}
+
+void PinI2C::enableCaptureInterrupts(bool enable){
+  wrapper->prepareCommand(pinEnableCaptureInterruptsCmd, myNum);
+  wrapper->buf.write(enable);
+  wrapper->sendCommand();
+}
+
+bool PinI2C::onCaptureDone(InterruptCallback callback){
+  return wrapper->onInterrupt(callback, interruptReason_captureDone); // there's only one capture, so any unit
+}
@@ -44,6 +44,38 @@ const uint8_t pinDigitalWriteCmd    = pinCmdOffset + 2;
 const uint8_t pinAnalogReadCmd      = pinCmdOffset + 3; const uint8_t pinAnalogReadResult  = 2; // 1 "int"
 const uint8_t pinAnalogWriteCmd     = pinCmdOffset + 4;
 const uint8_t pinAnalogReferenceCmd = pinCmdOffset + 5;
+const uint8_t pinStartCaptureCmd    = pinCmdOffset + 6;
+const uint8_t pinCaptureTriggerCmd  = pinCmdOffset + 7;
+/// @brief size of a CaptureSample as transmitted
+const uint8_t captureSampleSize = 4 + 1; // 1 uint32_t, 1 uint8_t
+/// @brief CaptureSamples that fit into one reply, minus 1 byte for the CRC8 and 2 bytes for the total number of samples
+const uint8_t captureSamplesPerFrame = (I2CmaxBuf - 3) / captureSampleSize;
+const uint8_t pinCaptureSamplesCmd  = pinCmdOffset + 8; const uint8_t pinCaptureSamplesResult = 2 + captureSamplesPerFrame * captureSampleSize; // 1 uint16_t + samples
+const uint8_t pinCaptureStateCmd    = pinCmdOffset + 9; const uint8_t pinCaptureStateResult   = 3; // 1 uint8_t, 1 uint16_t
+
+// Pin commands, continued (reserved 170 - 179 PinI2C)
+const uint8_t pinCmdOffset2         = 170;
+const uint8_t pinEnableCaptureInterruptsCmd = pinCmdOffset2 + 0;
+
+/// @brief max. number of pins sampled by PinI2C::startCapture()
+const uint8_t maxCapturePins = 8;
+
+/// @brief states of the pin capture, see PinI2C::captureState()
+const uint8_t captureIdle       = 0; ///< not started or stopped by fetchCapture()
+const uint8_t captureWaiting    = 1; ///< sampling, waiting for the trigger condition
+const uint8_t captureTriggered  = 2; ///< sampling, trigger condition was met
+const uint8_t captureDone       = 3; ///< all samples after the trigger taken
+
+const uint8_t interruptReason_captureDone = 12; ///< pin capture has taken all samples after the trigger, see PinI2C::setCaptureTrigger()
+
+/*!
+ * @brief One sample of the target's pin capture, see PinI2C::startCapture().
+ */
+struct CaptureSample
+{
+  uint32_t time;  ///< microseconds since the capture was started
+  uint8_t pins;   ///< one bit for each pin, bit 0 for the first pin given to PinI2C::startCapture()
+};
 
 /*!
   @brief An I2C wrapper class for remote analog and digital pin control.
@@ -76,6 +108,76 @@ public:
   int analogRead(uint8_t);
   void analogReference(uint8_t mode);
   void analogWrite(uint8_t, int);
+
+  /*!
+   * @brief Start capturing the levels of up to eight pins into a ring buffer
+   * in the target's RAM, like a simple logic analyzer. Sampling is done by
+   * the target's main loop without any bus traffic, so it can be much
+   * faster than polling digitalRead(). The buffer holds 48 samples on AVRs
+   * and 1024 on other platforms. A new capture discards the previous one.
+   * Make sure the pins are set up with pinMode() before.
+   * @param pins Pins to capture.
+   * @param numPins Number of pins, 1 to maxCapturePins.
+   * @param interval Time between samples in microseconds. With 0 (default),
+   * a sample is only taken if at least one pin has changed, which makes the
+   * most of the buffer for slow signals with fast edges, like encoders and
+   * endstops.
+   * @sa setCaptureTrigger(), fetchCapture()
+   */
+  void startCapture(const uint8_t pins[], uint8_t numPins, uint32_t interval = 0);
+
+  /*!
+   * @brief Set the trigger condition for the following startCapture()s.
+   * Until the condition is met, the ring buffer keeps the latest samples
+   * before it. From the sample that meets it on, postTrigger samples are
+   * taken, then the capture stops with captureState() captureDone and an
+   * interrupt with reason interruptReason_captureDone, if enabled with
+   * enableCaptureInterrupts().
+   * @param mask Pins to check, one bit for each pin as in CaptureSample::pins.
+   * The default 0 triggers right away.
+   * @param value Levels the masked pins must have.
+   * @param postTrigger Number of samples to take from the trigger on,
+   * default is the full buffer.
+   */
+  void setCaptureTrigger(uint8_t mask = 0, uint8_t value = 0, uint16_t postTrigger = 0xffff);
+
+  /*!
+   * @brief Find out if the capture is running, see setCaptureTrigger().
+   * @returns captureIdle, captureWaiting, captureTriggered, or captureDone,
+   * 0xff on transmission error.
+   */
+  uint8_t captureState();
+
+  /*!
+   * @brief Fetch the captured samples from the target, oldest first. Will
+   * stop a capture that's still running, so that the samples don't change
+   * while they are being fetched. Takes one transmission per three samples.
+   * @param samples Array which receives the samples.
+   * @param maxSamples Size of the samples array.
+   * @returns Number of samples stored in the array, 0 on transmission
+   * error (check I2Cwrapper::resultOK).
+   */
+  uint16_t fetchCapture(CaptureSample samples[], uint16_t maxSamples);
+
+  /*!
+   * @brief Tell the target to send an interrupt with reason
+   * interruptReason_captureDone when a capture is done. Off by default, as
+   * the target has only one interrupt to report, which would be overwritten
+   * by each finished capture.
+   * @param enable true (default) to enable, false to disable.
+   * @sa I2Cwrapper::setInterruptPin(), onCaptureDone()
+   */
+  void enableCaptureInterrupts(bool enable = true);
+
+  /*!
+   * @brief Register a function that will be called by
+   * I2Cwrapper::handleInterrupts() or I2Cwrapper::waitFor() when a capture
+   * is done. Needs I2Cwrapper::setInterruptPin(),
+   * I2Cwrapper::setControllerInterruptPin(), and enableCaptureInterrupts().
+   * @param callback Function to call, see InterruptCallback.
+   * @returns false if no more callbacks can be registered with the wrapper.
+   */
+  bool onCaptureDone(InterruptCallback callback);
   
 private:
   I2Cwrapper* wrapper;
@@ -93,6 +93,21 @@ unsigned long RotaryEncoderI2C::getRPM() {
   return (unsigned long)res;
 }
 
+float RotaryEncoderI2C::getVelocity() {
+  wrapper->prepareCommand(rotaryEncoderGetVelocityCmd, myNum);
+  int32_t res = 0;
+  if (wrapper->sendCommand() and wrapper->readResult(rotaryEncoderGetVelocityCmdResult)) {
+    wrapper->buf.read(res);
+  }
+  return float(res) / (1 << encoderVelocityFractionBits);
+}
+
+void RotaryEncoderI2C::setVelocityWindow(uint16_t milliseconds) {
+  wrapper->prepareCommand(rotaryEncoderSetVelocityWindowCmd, myNum);
+  wrapper->buf.write(milliseconds);
+  wrapper->sendCommand();
+}
+
 void RotaryEncoderI2C::startDiagnosticsMode(uint8_t numEncoder) {
   wrapper->prepareCommand(rotaryEncoderStartDiagnosticsModeCmd, myNum);
   wrapper->buf.write(numEncoder);
@@ -108,4 +123,65 @@ uint8_t RotaryEncoderI2C::getDiagnostics() {
   return res;
 }
 
+void RotaryEncoderI2C::setWindow(long lower, long upper) {
+  wrapper->prepareCommand(rotaryEncoderSetWindowCmd, myNum);
+  wrapper->buf.write((int32_t)lower);
+  wrapper->buf.write((int32_t)upper);
+  wrapper->sendCommand();
+}
+
+void RotaryEncoderI2C::setThreshold(long threshold) {
+  setWindow(threshold, INT32_MAX);
+}
+
+void RotaryEncoderI2C::clearWindow() {
+  setWindow(0, -1); // lower > upper switches it off
+}
+
+void RotaryEncoderI2C::setCountInterval(uint16_t counts) {
+  wrapper->prepareCommand(rotaryEncoderSetCountIntervalCmd, myNum);
+  wrapper->buf.write(counts);
+  wrapper->sendCommand();
+}
+
+bool RotaryEncoderI2C::onWindow(InterruptCallback callback) {
+  return wrapper->onInterrupt(callback, interruptReason_encoderWindow, myNum);
+}
+
+bool RotaryEncoderI2C::onCount(InterruptCallback callback) {
+  return wrapper->onInterrupt(callback, interruptReason_encoderCount, myNum);
+}
+
+// static, as it concerns all encoders of a target
+uint8_t RotaryEncoderI2C::snapshot(I2Cwrapper* w, EncoderStatus status[], uint8_t maxRecords, uint8_t mask) {
+  uint8_t numRecords = 0; // total number of records in the target's snapshot, known after the first transmission
+  uint8_t received = 0;
+  do {
+    w->prepareCommand(rotaryEncoderSnapshotCmd);
+    w->buf.write(mask);
+    w->buf.write(received); // first record to send, 0 makes the target take a new snapshot
+    if (not (w->sendCommand() and w->readResult(rotaryEncoderSnapshotCmdResult))) {
+      return 0;
+    }
+    w->buf.read(numRecords);
+    for (uint8_t r = 0; (r < encoderRecordsPerFrame) and (received < numRecords) and (received < maxRecords); r++) {
+      EncoderStatus* st = &status[received++];
+      uint8_t encoderAndDirection = 0;
+      int32_t l = 0;
+      w->buf.read(encoderAndDirection);
+      st->encoder = encoderAndDirection & ~(encoderRecordClockwise | encoderRecordCounterclockwise);
+      if (encoderAndDirection & encoderRecordClockwise) {
+        st->direction = RotaryEncoder::Direction::CLOCKWISE;
+      } else if (encoderAndDirection & encoderRecordCounterclockwise) {
+        st->direction = RotaryEncoder::Direction::COUNTERCLOCKWISE;
+      } else {
+        st->direction = RotaryEncoder::Direction::NOROTATION;
+      }
+      w->buf.read(l); st->position = l;
+      w->buf.read(st->lastChange);
+    }
+  } while ((received < numRecords) and (received < maxRecords));
+  return received;
+}
+
 
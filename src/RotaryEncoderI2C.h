@@ -41,9 +41,37 @@ const uint8_t rotaryEncoderSetPositionCmd  = rotaryEncoderCmdOffset + 3;
 const uint8_t rotaryEncoderGetMillisBetweenRotationsCmd  = rotaryEncoderCmdOffset + 4; const uint8_t rotaryEncoderGetMillisBetweenRotationsCmdResult = 4; // unsigned long
 const uint8_t rotaryEncoderGetRPMCmd  = rotaryEncoderCmdOffset + 5; const uint8_t rotaryEncoderGetRPMCmdResult =  4; // unsigned long
 const uint8_t rotaryEncoderStartDiagnosticsModeCmd  = rotaryEncoderCmdOffset + 6;
-//const uint8_t rotaryEncoderCmd  = rotaryEncoderCmdOffset + 7;
-//const uint8_t rotaryEncoderCmd  = rotaryEncoderCmdOffset + 8;
-//const uint8_t rotaryEncoderCmd  = rotaryEncoderCmdOffset + 9;
+/// @brief bytes used by one EncoderStatus record in a transmission
+const uint8_t encoderStatusSize = 1 + 2 * 4; // 1 uint8_t (encoder and direction), 1 int32_t, 1 uint32_t
+/// @brief EncoderStatus records that fit into one reply, minus 1 byte for the CRC8 and 1 byte for the total number of records
+const uint8_t encoderRecordsPerFrame = (I2CmaxBuf - 2) / encoderStatusSize;
+const uint8_t rotaryEncoderSnapshotCmd  = rotaryEncoderCmdOffset + 7; const uint8_t rotaryEncoderSnapshotCmdResult = 1 + encoderRecordsPerFrame * encoderStatusSize; // uint8_t + records
+const uint8_t rotaryEncoderSetWindowCmd  = rotaryEncoderCmdOffset + 8;
+const uint8_t rotaryEncoderSetCountIntervalCmd  = rotaryEncoderCmdOffset + 9;
+const uint8_t rotaryEncoderGetVelocityCmd  = rotaryEncoderCmdOffset + 10; const uint8_t rotaryEncoderGetVelocityCmdResult = 4; // int32_t, fixed point
+const uint8_t rotaryEncoderSetVelocityWindowCmd  = rotaryEncoderCmdOffset + 11;
+
+/// @brief fractional bits of the velocity as transmitted, see RotaryEncoderI2C::getVelocity()
+const uint8_t encoderVelocityFractionBits = 8;
+
+// RotaryEncoderI2C interrupt reasons
+const uint8_t interruptReason_encoderWindow = 10; ///< the encoder's position entered or left its window, see RotaryEncoderI2C::setWindow()
+const uint8_t interruptReason_encoderCount = 11; ///< the encoder has moved by its count interval, see RotaryEncoderI2C::setCountInterval()
+
+// direction flags in the encoder byte of a transmitted EncoderStatus record
+const uint8_t encoderRecordClockwise = 0x40;
+const uint8_t encoderRecordCounterclockwise = 0x80;
+
+/*!
+ * @brief Status of one encoder as reported by RotaryEncoderI2C::snapshot().
+ */
+struct EncoderStatus
+{
+  uint8_t encoder;                     ///< encoder number (myNum) this record belongs to
+  RotaryEncoder::Direction direction;  ///< direction of the last change of position, NOROTATION if it never changed
+  long position;                       ///< see RotaryEncoderI2C::getPosition()
+  uint32_t lastChange;                 ///< time of the last change of position, in microseconds of the target's micros() clock
+};
 
 
 /*!
@@ -95,6 +123,28 @@ public:
    * @returns (probably wrong) RPM
    */
   unsigned long getRPM();
+
+  /*!
+   * @brief Get the encoder's velocity as estimated by the target. Unlike
+   * getRPM() and getMillisBetweenRotations(), which use the millisecond
+   * timing of the last count only, the target measures counts in windows
+   * (see setVelocityWindow()) and divides them by the time between their
+   * microsecond timestamps. At low speed, this becomes the period between
+   * the last two counts, without counts the velocity decays and is 0 after
+   * one second.
+   * @returns Velocity in counts per second, with a resolution of 1/256
+   * counts per second. Positive if the position increases. The first call
+   * starts the estimation and returns 0.
+   */
+  float getVelocity();
+
+  /*!
+   * @brief Set the time window of the velocity estimation, see
+   * getVelocity(). Longer windows average over more counts and give smoother
+   * results, shorter ones react faster.
+   * @param milliseconds Window length, default is 10 ms.
+   */
+  void setVelocityWindow(uint16_t milliseconds);
   
   /*!
    * @brief Puts device in a diagnostics mode which is meant for analysing your quadrature
@@ -117,6 +167,81 @@ public:
    * @sa startDiagnosticsMode()
    */
   uint8_t getDiagnostics();
+
+  /*!
+   * @brief Let the target watch the encoder's position and interrupt the
+   * controller with reason interruptReason_encoderWindow whenever the
+   * position enters or leaves the window [lower, upper]. That's cheaper than
+   * polling getPosition() just to find out if something has happened. Needs
+   * I2Cwrapper::setInterruptPin(), there's no interrupt for the position the
+   * encoder is at when the window is set.
+   * @param lower,upper Window's limits, both are inside the window. If lower
+   * is greater than upper, the window is switched off.
+   * @sa setThreshold(), clearWindow(), onWindow()
+   */
+  void setWindow(long lower, long upper);
+
+  /*!
+   * @brief Interrupt with reason interruptReason_encoderWindow whenever the
+   * encoder's position crosses the threshold, in either direction. Same as
+   * a window from threshold upwards, see setWindow().
+   * @param threshold Lowest position above the threshold.
+   */
+  void setThreshold(long threshold);
+
+  /*!
+   * @brief Switch off the window or threshold set with setWindow() or
+   * setThreshold().
+   */
+  void clearWindow();
+
+  /*!
+   * @brief Interrupt with reason interruptReason_encoderCount every time the
+   * encoder has moved by the given number of counts, e.g. once per
+   * revolution. Counts are measured from the position the encoder is at when
+   * this is called. Needs I2Cwrapper::setInterruptPin().
+   * @param counts Counts between interrupts, 0 switches them off.
+   * @note Interrupts are checked by the target's main loop, so if the
+   * encoder moves by more than one interval in the meantime, there will be
+   * only one interrupt.
+   */
+  void setCountInterval(uint16_t counts);
+
+  /*!
+   * @brief Register a function that will be called by
+   * I2Cwrapper::handleInterrupts() or I2Cwrapper::waitFor() when this
+   * encoder has entered or left its window, see setWindow(). Needs
+   * I2Cwrapper::setControllerInterruptPin().
+   * @param callback Function to call, see InterruptCallback.
+   * @returns false if no more callbacks can be registered with the wrapper.
+   */
+  bool onWindow(InterruptCallback callback);
+
+  /*!
+   * @brief Register a function that will be called when this encoder has
+   * moved by its count interval, see setCountInterval() and onWindow().
+   */
+  bool onCount(InterruptCallback callback);
+
+  /*!
+   * @brief Get the status of all (or some) encoders of a target at once.
+   * Instead of separate calls to getPosition(), getDirection() etc. for each
+   * encoder, the target latches all selected encoders at the same moment and
+   * sends them in as few transmissions as the I2C buffer size allows
+   * (currently two encoders per transmission).
+   * @param w Wrapper object representing the target.
+   * @param status Array which receives one record for each selected encoder,
+   * in the order of their encoder numbers.
+   * @param maxRecords Size of the status array.
+   * @param mask One bit for each encoder to include, bit 0 for encoder 0 etc.
+   * Defaults to all encoders. Bits of unknown encoders are ignored.
+   * @returns Number of records stored in the status array, 0 on transmission
+   * error (check I2Cwrapper::resultOK).
+   * @note The timestamps tell when each encoder last counted, so that speeds
+   * can be derived from two snapshots without relying on the timing of the
+   * I2C bus.
+   */
+  static uint8_t snapshot(I2Cwrapper* w, EncoderStatus status[], uint8_t maxRecords, uint8_t mask = 0xff);
     
   int8_t myNum = -1;    // for modules that support units, i.e. more than one instance of the hardware represented by this class
   
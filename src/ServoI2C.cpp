@@ -94,3 +94,105 @@ bool ServoI2C::attached()
   return (bool)res;
 }
 
+void ServoI2C::moveTo(int value, uint16_t duration, uint8_t easing)
+{
+  wrapper->prepareCommand(servoMoveCmd, myNum);
+  wrapper->buf.write((int16_t)value);
+  wrapper->buf.write(duration);
+  wrapper->buf.write(easing);
+  wrapper->sendCommand();
+}
+
+bool ServoI2C::moving()
+{
+  wrapper->prepareCommand(servoMovingCmd, myNum);
+  uint8_t res = false;
+  if (wrapper->sendCommand() and wrapper->readResult(servoMovingResult)) {
+    wrapper->buf.read(res);
+  }
+  return (bool)res;
+}
+
+void ServoI2C::enableInterrupts(bool enable)
+{
+  wrapper->prepareCommand(servoEnableInterruptsCmd, myNum);
+  wrapper->buf.write(enable);
+  wrapper->sendCommand();
+}
+
+bool ServoI2C::onMoveDone(InterruptCallback callback)
+{
+  return wrapper->onInterrupt(callback, interruptReason_servoMoveDone, myNum);
+}
+
+// static, as it concerns several servos of a target
+void ServoI2C::writeGroup(I2Cwrapper* w, uint16_t mask, const int values[])
+{
+  w->prepareCommand(servoWriteGroupCmd);
+  w->buf.write(mask);
+  uint8_t v = 0;
+  for (uint8_t s = 0; (s < 16) and (v < maxServoGroupSize); s++) {
+    if (mask & (1u << s)) {
+      w->buf.write((int16_t)values[v++]);
+    }
+  }
+  w->sendCommand();
+}
+
+// static, as there is one animation per target
+void ServoI2C::clearAnimation(I2Cwrapper* w, uint16_t mask)
+{
+  w->prepareCommand(servoClearAnimationCmd);
+  w->buf.write(mask);
+  w->sendCommand();
+}
+
+int8_t ServoI2C::addKeyframe(I2Cwrapper* w, uint16_t time, const int values[], uint8_t numValues, uint8_t easing)
+{
+  w->prepareCommand(servoAddKeyframeCmd);
+  w->buf.write(time);
+  w->buf.write(easing);
+  for (uint8_t v = 0; (v < numValues) and (v < maxAnimationServos); v++) {
+    w->buf.write((int16_t)values[v]);
+  }
+  int8_t res = -1;
+  if (w->sendCommand() and w->readResult(servoAddKeyframeResult)) {
+    w->buf.read(res);
+  }
+  return res;
+}
+
+void ServoI2C::playAnimation(I2Cwrapper* w, bool loop)
+{
+  w->prepareCommand(servoPlayAnimationCmd);
+  w->buf.write(loop);
+  w->sendCommand();
+}
+
+void ServoI2C::stopAnimation(I2Cwrapper* w)
+{
+  w->prepareCommand(servoStopAnimationCmd);
+  w->sendCommand();
+}
+
+bool ServoI2C::animationPlaying(I2Cwrapper* w)
+{
+  w->prepareCommand(servoAnimationPlayingCmd);
+  uint8_t res = false;
+  if (w->sendCommand() and w->readResult(servoAnimationPlayingResult)) {
+    w->buf.read(res);
+  }
+  return (bool)res;
+}
+
+void ServoI2C::enableAnimationInterrupts(I2Cwrapper* w, bool enable)
+{
+  w->prepareCommand(servoEnableAnimationInterruptsCmd);
+  w->buf.write(enable);
+  w->sendCommand();
+}
+
+bool ServoI2C::onAnimationDone(I2Cwrapper* w, InterruptCallback callback)
+{
+  return w->onInterrupt(callback, interruptReason_servoAnimationDone);
+}
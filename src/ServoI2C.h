@@ -45,6 +45,34 @@ const uint8_t servoWriteMicrosecondsCmd = servoCmdOffset + 4;
 const uint8_t servoReadCmd              = servoCmdOffset + 5; const uint8_t servoReadResult              = 2; // 1 int
 const uint8_t servoReadMicrosecondsCmd  = servoCmdOffset + 6; const uint8_t servoReadMicrosecondsResult  = 2; // 1 int
 const uint8_t servoAttachedCmd          = servoCmdOffset + 7; const uint8_t servoAttachedResult          = 1; // 1 bool
+const uint8_t servoMoveCmd              = servoCmdOffset + 8;
+const uint8_t servoMovingCmd            = servoCmdOffset + 9; const uint8_t servoMovingResult            = 1; // 1 bool
+
+// Servo commands, continued (reserved 150 - 159 ServoI2C)
+const uint8_t servoCmdOffset2           = 150;
+const uint8_t servoWriteGroupCmd        = servoCmdOffset2 + 0;
+const uint8_t servoClearAnimationCmd    = servoCmdOffset2 + 1;
+const uint8_t servoAddKeyframeCmd       = servoCmdOffset2 + 2; const uint8_t servoAddKeyframeResult       = 1; // 1 int8_t
+const uint8_t servoPlayAnimationCmd     = servoCmdOffset2 + 3;
+const uint8_t servoStopAnimationCmd     = servoCmdOffset2 + 4;
+const uint8_t servoAnimationPlayingCmd  = servoCmdOffset2 + 5; const uint8_t servoAnimationPlayingResult  = 1; // 1 bool
+const uint8_t servoEnableInterruptsCmd  = servoCmdOffset2 + 6;
+const uint8_t servoEnableAnimationInterruptsCmd = servoCmdOffset2 + 7;
+
+/// @brief max. number of servos in one ServoI2C::writeGroup(), as all values need to fit into one transmission
+const uint8_t maxServoGroupSize = (I2CmaxBuf - 5) / sizeof(int16_t);
+
+/// @brief max. number of servos in an animation, as all positions of a keyframe need to fit into one transmission
+const uint8_t maxAnimationServos = (I2CmaxBuf - 6) / sizeof(int16_t);
+
+/// @brief easing curves for ServoI2C::moveTo()
+const uint8_t servoEaseLinear           = 0; ///< constant speed
+const uint8_t servoEaseIn               = 1; ///< start slowly, quadratic
+const uint8_t servoEaseOut              = 2; ///< end slowly, quadratic
+const uint8_t servoEaseInOut            = 3; ///< start and end slowly, cubic
+
+const uint8_t interruptReason_servoMoveDone = 13; ///< the servo has finished its ServoI2C::moveTo()
+const uint8_t interruptReason_servoAnimationDone = 14; ///< the target's servo animation has played its last keyframe, see ServoI2C::playAnimation()
 
 
 /*!
@@ -57,6 +85,10 @@ const uint8_t servoAttachedCmd          = servoCmdOffset + 7; const uint8_t serv
   Functions and parameters without documentation will work just as their original,
   but you need to take the general restrictions into account (e.g. don't take a return
   value for valid without error handling).
+  Supports up to 2 servos on ATtiny85, 12 on other AVRs, and 16 on other
+  platforms. Detached servos free their slot (myNum) for the next attach().
+  On ESP32, the firmware can optionally drive the servos with the LEDC
+  hardware PWM, see SERVOI2C_LEDC in ServoI2C_firmware.h.
   @note Currently, the implementation is quite dumb, as it passes any Servo library
   call over I2C, regardless of what it does. Write() e.g. uses WriteMicroseconds(),
   so that in theory it could be implemented wholly on the controller's side.
@@ -92,6 +124,138 @@ public:
   int readMicroseconds();
   bool attached();
 
+  /*!
+   * @brief Let the target move the servo smoothly to a new position, instead
+   * of sending lots of write()s. Any write(), writeMicroseconds(), or
+   * detach() cancels the move.
+   * @param value Target position, in degrees or microseconds just as with
+   * write().
+   * @param duration Time the move takes in ms.
+   * @param easing Speed profile of the move, servoEaseLinear, servoEaseIn,
+   * servoEaseOut, or servoEaseInOut (default).
+   * @note The move starts at the last position written, so a freshly attached
+   * servo that was never written to starts at the middle position.
+   * @sa moving(), onMoveDone()
+   */
+  void moveTo(int value, uint16_t duration, uint8_t easing = servoEaseInOut);
+
+  /*!
+   * @brief Find out if a moveTo() is still in progress.
+   * @returns true if moving, false if not or on transmission error
+   */
+  bool moving();
+
+  /*!
+   * @brief Tell the target to send an interrupt with reason
+   * interruptReason_servoMoveDone when this servo has finished a moveTo().
+   * Off by default, as the target has only one interrupt to report, which
+   * would be overwritten by each finished move.
+   * @param enable true (default) to enable, false to disable.
+   * @sa I2Cwrapper::setInterruptPin(), onMoveDone()
+   */
+  void enableInterrupts(bool enable = true);
+
+  /*!
+   * @brief Register a function that will be called by
+   * I2Cwrapper::handleInterrupts() or I2Cwrapper::waitFor() when this servo
+   * has finished a moveTo(). Needs I2Cwrapper::setInterruptPin(),
+   * I2Cwrapper::setControllerInterruptPin(), and enableInterrupts().
+   * @param callback Function to call, see InterruptCallback.
+   * @returns false if no more callbacks can be registered with the wrapper.
+   */
+  bool onMoveDone(InterruptCallback callback);
+
+  /*!
+   * @brief Write new positions to several servos of a target at once. All
+   * values are sent in one transmission and applied by the target in one go,
+   * so that the servos change together, not one transmission time apart.
+   * Cancels moveTo()s of the servos written to.
+   * @param w Wrapper object representing the target.
+   * @param mask One bit for each servo to write, bit 0 for servo 0 (myNum)
+   * etc., so servos 0 to 15 can be addressed. At most maxServoGroupSize (7)
+   * bits may be set.
+   * @param values One value for each bit set in the mask, in the order of
+   * the servos' numbers. Degrees or microseconds, just as with write().
+   */
+  static void writeGroup(I2Cwrapper* w, uint16_t mask, const int values[]);
+
+  /*!
+   * @brief Start a new keyframe animation, discarding the previous one. An
+   * animation is a table of keyframes with positions for a set of servos,
+   * uploaded with addKeyframe() and played by the target with
+   * playAnimation(), without any further bus traffic. There is one animation
+   * per target, its table holds 16 keyframes on AVRs and 64 on other
+   * platforms.
+   * @param w Wrapper object representing the target.
+   * @param mask Servos that take part in the animation, one bit for each
+   * servo as in writeGroup(). At most maxAnimationServos (7), servos that
+   * are not attached yet are ignored.
+   */
+  static void clearAnimation(I2Cwrapper* w, uint16_t mask);
+
+  /*!
+   * @brief Append a keyframe to the animation, see clearAnimation().
+   * Keyframes can't be added while the animation is playing.
+   * @param w Wrapper object representing the target.
+   * @param time Time of the keyframe in ms from the start of the
+   * animation. Must be greater than that of the previous keyframe.
+   * @param values One position for each servo in the animation's mask, in
+   * the order of the servos' numbers, in degrees or microseconds as with
+   * write().
+   * @param numValues Number of values, must match the number of servos in
+   * the animation.
+   * @param easing Speed profile of the servos' moves from the previous
+   * keyframe to this one, see moveTo().
+   * @returns Number of keyframes in the animation including this one, -1 if
+   * the keyframe was rejected or on transmission error.
+   */
+  static int8_t addKeyframe(I2Cwrapper* w, uint16_t time, const int values[], uint8_t numValues, uint8_t easing = servoEaseLinear);
+
+  /*!
+   * @brief Play the animation. The servos move from where they are to the
+   * first keyframe, and then from keyframe to keyframe. At the end, an
+   * interrupt with reason interruptReason_servoAnimationDone is raised
+   * (unit 0), if enabled with enableAnimationInterrupts(). While it plays, the animation controls its servos, so don't
+   * write() or moveTo() them.
+   * @param w Wrapper object representing the target.
+   * @param loop If true, the animation is repeated until stopped, with the
+   * servos moving from the last keyframe to the first one in the time of the
+   * first keyframe. There's no interrupt in this case.
+   */
+  static void playAnimation(I2Cwrapper* w, bool loop = false);
+
+  /*!
+   * @brief Stop the animation where it is.
+   * @param w Wrapper object representing the target.
+   */
+  static void stopAnimation(I2Cwrapper* w);
+
+  /*!
+   * @brief Find out if the animation is still playing.
+   * @param w Wrapper object representing the target.
+   * @returns true if playing, false if not or on transmission error
+   */
+  static bool animationPlaying(I2Cwrapper* w);
+
+  /*!
+   * @brief Tell the target to send an interrupt with reason
+   * interruptReason_servoAnimationDone when an animation has finished. Off
+   * by default, see enableInterrupts().
+   * @param w Wrapper object representing the target.
+   * @param enable true (default) to enable, false to disable.
+   */
+  static void enableAnimationInterrupts(I2Cwrapper* w, bool enable = true);
+
+  /*!
+   * @brief Register a function that will be called by
+   * I2Cwrapper::handleInterrupts() or I2Cwrapper::waitFor() when the
+   * animation has finished, see onMoveDone() and enableAnimationInterrupts().
+   * @param w Wrapper object representing the target.
+   * @param callback Function to call, see InterruptCallback.
+   * @returns false if no more callbacks can be registered with the wrapper.
+   */
+  static bool onAnimationDone(I2Cwrapper* w, InterruptCallback callback);
+
   int8_t myNum = -1;    ///< Servo number with myNum >= 0 for successfully added servo.
 
 private: